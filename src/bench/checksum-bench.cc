@@ -0,0 +1,76 @@
+/*
+ * This file is part of the hoschi p2p scan engine.
+ *
+ * (C) 2019 by Sebastian Krahmer,
+ *             sebastian [dot] krahmer [at] gmail [dot] com
+ *
+ * hoschi is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * hoschi is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with hoschi. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Cost of verifying the checksum of a full (1000 entries) addr msg.
+
+#include <string>
+#include <cstdio>
+#include <cstdlib>
+#include <chrono>
+#include <arpa/inet.h>
+#include "../protocol.h"
+#include "../misc.h"
+
+
+using namespace std;
+using namespace hoschi;
+
+
+int main(int argc, char **argv)
+{
+	unsigned int entries = 1000, rounds = 20000;
+
+	if (argc > 1)
+		entries = strtoul(argv[1], nullptr, 10);
+	if (argc > 2)
+		rounds = strtoul(argv[2], nullptr, 10);
+
+	btc_messages::net_addr na;
+	na.services = htobtc64(numbers::node_network);
+	na.port = htons(8333);
+
+	string payload = make_valint(entries);
+	for (unsigned int i = 0; i < entries; ++i) {
+		na.time = htobtc32(i);
+		na.addr_bytes[15] = i & 0xff;
+		payload += string(reinterpret_cast<char *>(&na), sizeof(na));
+	}
+
+	btc_header hdr("addr");
+	hdr.checksum(payload);
+	string msg = hdr.header_string() + payload;
+
+	btc_header rx;
+	unsigned int bad = 0;
+
+	auto start = chrono::steady_clock::now();
+	for (unsigned int i = 0; i < rounds; ++i) {
+		if (rx.parse(msg.c_str(), msg.size()) < 0 || rx.verify(msg.c_str(), msg.size()) < 0)
+			++bad;
+	}
+	auto end = chrono::steady_clock::now();
+
+	double ns = chrono::duration<double, nano>(end - start).count()/rounds;
+
+	printf("addr msg: %u entries, %zu bytes, %u rounds, %u failed\n", entries, msg.size(), rounds, bad);
+	printf("verify: %.0f ns/msg, %.1f MB/s, %.0f msgs/s\n", ns, msg.size()*1000/ns, 1e9/ns);
+
+	return bad != 0;
+}
@@ -0,0 +1,587 @@
+/*
+ * This file is part of the hoschi p2p scan engine.
+ *
+ * (C) 2019 by Sebastian Krahmer,
+ *             sebastian [dot] krahmer [at] gmail [dot] com
+ *
+ * hoschi is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * hoschi is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with hoschi. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Whole scans against a simulated network on loopback. Every live peer gets a
+// listener on 127.x.y.z (or on ::1 with a port of its own) and answers version
+// with version+verack and getaddr with an addr msg of its neighbours in a random
+// graph. The crawler is run on it as a child and the speed of discovery, the
+// handshakes and what the crawler used in CPU and memory are reported, so that
+// engine changes can be compared on the same workload.
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <random>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <arpa/inet.h>
+#include "../protocol.h"
+#include "../node-addr.h"
+#include "../misc.h"
+
+
+using namespace std;
+using namespace hoschi;
+
+
+struct peer {
+	node_addr addr;
+	bool dead{0}, found{0};
+	int lfd{-1};
+	vector<uint32_t> neighbours;
+
+	// built on first getaddr and then sent to every further one
+	string addr_msg{""};
+};
+
+
+struct conn {
+	uint32_t peer{0}, gen{0};
+	bool open{0}, want_out{0};
+	string rx{""}, tx{""};
+};
+
+
+// reply that is held back for the latency; the gen tells whether the fd
+// still belongs to the same connection when it is due
+struct delayed {
+	uint64_t due;
+	int fd;
+	uint32_t gen;
+	string msg;
+};
+
+
+static vector<peer> peers;
+static vector<conn> conns;
+static deque<delayed> replies;
+
+static int ep = -1;
+static uint32_t latency = 0;
+
+static uint64_t accepted = 0, handshakes = 0, addr_msgs = 0, found = 0;
+static uint64_t t_start = 0, t_found = 0;
+
+
+static uint64_t now_ms()
+{
+	return chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+
+static void usage()
+{
+	fprintf(stderr, "Usage: peer-sim [-n peers] [-k degree] [-x dead%%] [-l msec] [-6 peers] [-p port] [-S seed] [-t sec] [-- crawler [args]]\n"
+	        "\t-n -- number of simulated peers; default: 2000\n"
+	        "\t-k -- number of neighbours every peer advertises, at most 1000; default: 100\n"
+	        "\t-x -- percentage of advertised peers that are dead; default: 20\n"
+	        "\t-l -- delay every reply by that many milliseconds; default: 0\n"
+	        "\t-6 -- how many of the peers listen on ::1 rather than on 127.x.y.z; default: 100\n"
+	        "\t-p -- port of the 127.x.y.z peers, the ::1 peers use the ones above; default: 18444\n"
+	        "\t-S -- seed of the random graph; default: 1\n"
+	        "\t-t -- kill the crawler after that many seconds; default: 600\n"
+	        "\tcrawler and its args default to build/hoschi, which is run with -4 127.0.0.1 -6 ::1 -U -R 0,\n"
+	        "\tthe seed peer and dump and log files in a temp dir; args given here come last and override these\n");
+	exit(1);
+}
+
+
+static int nonblock(int fd)
+{
+	int flags = fcntl(fd, F_GETFL);
+	if (flags < 0)
+		return -1;
+	return fcntl(fd, F_SETFL, flags|O_NONBLOCK);
+}
+
+
+static void build_graph(uint32_t n, uint32_t k, uint32_t dead, uint32_t n6, uint16_t port, uint32_t seed)
+{
+	mt19937 rng(seed);
+	uniform_int_distribution<uint32_t> any(0, n - 1), percent(0, 99);
+
+	peers.resize(n);
+	for (uint32_t i = 0; i < n; ++i) {
+		peer &p = peers[i];
+
+		if (i < n - n6) {
+			uint32_t v = i + 2;
+			p.addr.ip[10] = p.addr.ip[11] = 0xff;
+			p.addr.ip[12] = 127;
+			p.addr.ip[13] = (v>>16) & 0xff;
+			p.addr.ip[14] = (v>>8) & 0xff;
+			p.addr.ip[15] = v & 0xff;
+			p.addr.port = htons(port);
+		} else {
+			p.addr.ip[15] = 1;
+			p.addr.port = htons(port + 1 + i - (n - n6));
+		}
+
+		// the seed must answer, or there is no scan at all
+		p.dead = (i > 0 && percent(rng) < dead);
+
+		for (uint32_t j = 0; j < k; ++j) {
+			uint32_t o = any(rng);
+			if (o != i)
+				p.neighbours.push_back(o);
+		}
+	}
+}
+
+
+// live peers that can be found from the seed at all
+static uint32_t reachable()
+{
+	vector<uint8_t> seen(peers.size(), 0);
+	vector<uint32_t> todo{0};
+	uint32_t r = 0;
+
+	seen[0] = 1;
+	while (!todo.empty()) {
+		uint32_t i = todo.back();
+		todo.pop_back();
+		if (peers[i].dead)
+			continue;
+		++r;
+		for (auto o : peers[i].neighbours) {
+			if (!seen[o]) {
+				seen[o] = 1;
+				todo.push_back(o);
+			}
+		}
+	}
+	return r;
+}
+
+
+static const string &addr_msg(peer &p)
+{
+	if (p.addr_msg.size())
+		return p.addr_msg;
+
+	btc_messages::net_addr na;
+	na.time = htobtc32(uint32_t(time(nullptr)));
+	na.services = htobtc64(numbers::node_network);
+
+	string payload = make_valint(p.neighbours.size());
+	for (auto o : p.neighbours) {
+		memcpy(na.addr_bytes, peers[o].addr.ip, sizeof(na.addr_bytes));
+		na.port = peers[o].addr.port;
+		payload += string(reinterpret_cast<char *>(&na), sizeof(na));
+	}
+
+	btc_header hdr("addr");
+	hdr.checksum(payload);
+	p.addr_msg = hdr.header_string() + payload;
+	return p.addr_msg;
+}
+
+
+static void close_conn(int fd)
+{
+	epoll_ctl(ep, EPOLL_CTL_DEL, fd, nullptr);
+	close(fd);
+
+	conn &c = conns[fd];
+	c.open = 0;
+	c.want_out = 0;
+	c.rx.clear();
+	c.tx.clear();
+	++c.gen;
+}
+
+
+static int flush(int fd)
+{
+	conn &c = conns[fd];
+
+	while (c.tx.size()) {
+		ssize_t r = write(fd, c.tx.c_str(), c.tx.size());
+		if (r < 0) {
+			if (errno == EAGAIN)
+				break;
+			return -1;
+		}
+		c.tx.erase(0, r);
+	}
+
+	bool want_out = c.tx.size() > 0;
+	if (want_out != c.want_out) {
+		struct epoll_event ev;
+		memset(&ev, 0, sizeof(ev));
+		ev.events = EPOLLIN|(want_out ? EPOLLOUT : 0);
+		ev.data.u64 = fd;
+		epoll_ctl(ep, EPOLL_CTL_MOD, fd, &ev);
+		c.want_out = want_out;
+	}
+	return 0;
+}
+
+
+static int reply(int fd, const string &msg)
+{
+	if (latency > 0) {
+		replies.push_back({now_ms() + latency, fd, conns[fd].gen, msg});
+		return 0;
+	}
+	conns[fd].tx += msg;
+	return flush(fd);
+}
+
+
+// handle all complete msgs in the rx buffer
+static int handle(int fd)
+{
+	conn &c = conns[fd];
+	peer &p = peers[c.peer];
+	const size_t hlen = sizeof(btc_header::header);
+
+	while (c.rx.size() >= hlen) {
+		btc_header::header h;
+		memcpy(&h, c.rx.c_str(), hlen);
+
+		if (btctoh32(h.magic) != numbers::testnet3)
+			return -1;
+		size_t len = hlen + btctoh32(h.paylen);
+		if (len > numbers::max_paylen)
+			return -1;
+		if (c.rx.size() < len)
+			break;
+
+		string cmd(h.command, strnlen(h.command, sizeof(h.command)));
+		c.rx.erase(0, len);
+
+		int r = 0;
+		if (cmd == "version")
+			r = reply(fd, make_version(p.addr) + make_verack());
+		else if (cmd == "verack") {
+			++handshakes;
+			if (!p.found) {
+				p.found = 1;
+				++found;
+				t_found = now_ms();
+			}
+		} else if (cmd == "getaddr") {
+			++addr_msgs;
+			r = reply(fd, addr_msg(p));
+		}
+		if (r < 0)
+			return -1;
+	}
+	return 0;
+}
+
+
+static void accept_all(int lfd, uint32_t pi)
+{
+	for (;;) {
+		int fd = accept4(lfd, nullptr, nullptr, SOCK_NONBLOCK|SOCK_CLOEXEC);
+		if (fd < 0)
+			return;
+
+		if (size_t(fd) >= conns.size())
+			conns.resize(fd + 1024);
+
+		conn &c = conns[fd];
+		c.peer = pi;
+		c.open = 1;
+
+		struct epoll_event ev;
+		memset(&ev, 0, sizeof(ev));
+		ev.events = EPOLLIN;
+		ev.data.u64 = fd;
+		if (epoll_ctl(ep, EPOLL_CTL_ADD, fd, &ev) < 0) {
+			close_conn(fd);
+			continue;
+		}
+		++accepted;
+	}
+}
+
+
+static void readable(int fd)
+{
+	conn &c = conns[fd];
+	char buf[0x4000];
+	bool eof = 0;
+
+	for (;;) {
+		ssize_t r = read(fd, buf, sizeof(buf));
+		if (r < 0 && errno == EAGAIN)
+			break;
+		if (r <= 0) {
+			eof = 1;
+			break;
+		}
+		c.rx.append(buf, r);
+	}
+
+	if (handle(fd) < 0 || eof)
+		close_conn(fd);
+}
+
+
+static void release_replies()
+{
+	uint64_t now = now_ms();
+
+	// same latency for all, so the queue is ordered by due time
+	while (!replies.empty() && replies.front().due <= now) {
+		delayed &d = replies.front();
+		conn &c = conns[d.fd];
+		if (c.open && c.gen == d.gen) {
+			c.tx += d.msg;
+			if (flush(d.fd) < 0)
+				close_conn(d.fd);
+		}
+		replies.pop_front();
+	}
+}
+
+
+static int listen_all()
+{
+	uint32_t live = 0;
+
+	for (uint32_t i = 0; i < peers.size(); ++i) {
+		if (peers[i].dead)
+			continue;
+
+		sockaddr_storage ss;
+		socklen_t slen = peers[i].addr.to_sockaddr(ss);
+
+		int fd = socket(peers[i].addr.family(), SOCK_STREAM|SOCK_CLOEXEC, 0);
+		if (fd < 0)
+			return -1;
+		int one = 1;
+		setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+		if (bind(fd, reinterpret_cast<sockaddr *>(&ss), slen) < 0 || listen(fd, 128) < 0 || nonblock(fd) < 0) {
+			fprintf(stderr, "peer-sim: listen on %s: %s\n", peers[i].addr.str().c_str(), strerror(errno));
+			return -1;
+		}
+
+		struct epoll_event ev;
+		memset(&ev, 0, sizeof(ev));
+		ev.events = EPOLLIN;
+		ev.data.u64 = (uint64_t(1)<<32)|i;
+		if (epoll_ctl(ep, EPOLL_CTL_ADD, fd, &ev) < 0)
+			return -1;
+		peers[i].lfd = fd;
+		++live;
+	}
+	return live;
+}
+
+
+static pid_t spawn(vector<string> &args)
+{
+	vector<char *> argv;
+	for (auto &a : args)
+		argv.push_back(&a[0]);
+	argv.push_back(nullptr);
+
+	pid_t pid = fork();
+	if (pid == 0) {
+		int null = open("/dev/null", O_WRONLY);
+		if (null >= 0)
+			dup2(null, 1);
+		execvp(argv[0], &argv[0]);
+		fprintf(stderr, "peer-sim: exec %s: %s\n", argv[0], strerror(errno));
+		_exit(1);
+	}
+	return pid;
+}
+
+
+int main(int argc, char **argv)
+{
+	uint32_t n = 2000, k = 100, dead = 20, n6 = 100, seed = 1, max_secs = 600;
+	uint16_t port = 18444;
+	int c = 0;
+
+	while ((c = getopt(argc, argv, "n:k:x:l:6:p:S:t:")) != -1) {
+		switch (c) {
+		case 'n':
+			n = strtoul(optarg, nullptr, 10);
+			break;
+		case 'k':
+			k = strtoul(optarg, nullptr, 10);
+			break;
+		case 'x':
+			dead = strtoul(optarg, nullptr, 10);
+			break;
+		case 'l':
+			latency = strtoul(optarg, nullptr, 10);
+			break;
+		case '6':
+			n6 = strtoul(optarg, nullptr, 10);
+			break;
+		case 'p':
+			port = strtoul(optarg, nullptr, 10);
+			break;
+		case 'S':
+			seed = strtoul(optarg, nullptr, 10);
+			break;
+		case 't':
+			max_secs = strtoul(optarg, nullptr, 10);
+			break;
+		default:
+			usage();
+		}
+	}
+
+	if (n < 2 || n > 0xfffff0 || k == 0 || k > 1000 || dead > 99 || n6 >= n || n6 > 0xffffu - port || port <= 1024)
+		usage();
+
+	vector<string> args;
+	if (optind < argc)
+		args.push_back(argv[optind++]);
+	else
+		args.push_back("build/hoschi");
+
+	char tmpl[] = "/tmp/peer-sim.XXXXXX";
+	if (!mkdtemp(tmpl)) {
+		perror("peer-sim: mkdtemp");
+		return 1;
+	}
+	string dir = tmpl;
+
+	struct rlimit rl;
+	if (getrlimit(RLIMIT_NOFILE, &rl) == 0) {
+		rl.rlim_cur = rl.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &rl);
+	}
+	signal(SIGPIPE, SIG_IGN);
+
+	build_graph(n, k, dead, n6, port, seed);
+
+	if ((ep = epoll_create1(EPOLL_CLOEXEC)) < 0) {
+		perror("peer-sim: epoll_create1");
+		return 1;
+	}
+	int live = listen_all();
+	if (live < 0) {
+		perror("peer-sim: listen");
+		return 1;
+	}
+	uint32_t reach = reachable();
+
+	for (auto a : {"-4", "127.0.0.1", "-6", "::1", "-U", "-R", "0"})
+		args.push_back(a);
+	args.push_back("-s");
+	args.push_back(peers[0].addr.str());
+	args.push_back("-d");
+	args.push_back(dir + "/nodemap.txt");
+	args.push_back("-l");
+	args.push_back(dir + "/btclog.txt");
+	for (; optind < argc; ++optind)
+		args.push_back(argv[optind]);
+
+	printf("peers: %u (%d live, %u of them reachable from the seed, %u on ::1), degree %u, latency %ums\n",
+	       n, live, reach, n6, k, latency);
+
+	t_start = now_ms();
+	pid_t pid = spawn(args);
+	if (pid < 0) {
+		perror("peer-sim: fork");
+		return 1;
+	}
+
+	int status = 0;
+	bool killed = 0;
+	struct rusage ru;
+	memset(&ru, 0, sizeof(ru));
+
+	vector<epoll_event> evs(1024);
+	for (;;) {
+		int timeout = 100;
+		if (!replies.empty()) {
+			uint64_t now = now_ms();
+			timeout = replies.front().due > now ? int(replies.front().due - now) : 0;
+			if (timeout > 100)
+				timeout = 100;
+		}
+
+		int r = epoll_wait(ep, &evs[0], evs.size(), timeout);
+		if (r < 0 && errno != EINTR) {
+			perror("peer-sim: epoll_wait");
+			kill(pid, SIGKILL);
+			break;
+		}
+
+		for (int i = 0; i < r; ++i) {
+			uint64_t d = evs[i].data.u64;
+			if (d>>32) {
+				uint32_t pi = d & 0xffffffff;
+				accept_all(peers[pi].lfd, pi);
+				continue;
+			}
+
+			int fd = int(d);
+			if ((evs[i].events & EPOLLOUT) && conns[fd].open && flush(fd) < 0)
+				close_conn(fd);
+			if ((evs[i].events & (EPOLLIN|EPOLLHUP|EPOLLERR)) && conns[fd].open)
+				readable(fd);
+		}
+
+		release_replies();
+
+		if (wait4(pid, &status, WNOHANG, &ru) == pid)
+			break;
+		if (!killed && now_ms() - t_start > uint64_t(max_secs)*1000) {
+			kill(pid, SIGKILL);
+			killed = 1;
+		}
+	}
+
+	uint64_t t_end = now_ms();
+	double secs = (t_end - t_start)/1000.0, found_secs = found ? (t_found - t_start)/1000.0 : 0;
+
+	if (killed)
+		printf("crawler: killed after %.1fs\n", secs);
+	else if (WIFEXITED(status))
+		printf("crawler: exited with %d after %.1fs\n", WEXITSTATUS(status), secs);
+	else
+		printf("crawler: died from signal %d after %.1fs\n", WTERMSIG(status), secs);
+
+	printf("discovered: %llu of %u reachable peers, the last one after %.1fs: %.0f nodes/s\n",
+	       (unsigned long long)found, reach, found_secs, found_secs > 0 ? found/found_secs : 0.0);
+	printf("handshakes: %llu of %llu connects in %.1fs: %.0f/s\n", (unsigned long long)handshakes,
+	       (unsigned long long)accepted, secs, secs > 0 ? handshakes/secs : 0.0);
+	printf("addr msgs:  %llu served\n", (unsigned long long)addr_msgs);
+	printf("cpu:        %.2fs user, %.2fs sys\n", ru.ru_utime.tv_sec + ru.ru_utime.tv_usec/1e6,
+	       ru.ru_stime.tv_sec + ru.ru_stime.tv_usec/1e6);
+	printf("peak rss:   %.1f MB\n", ru.ru_maxrss/1024.0);
+	printf("dump, log:  %s\n", dir.c_str());
+
+	return (killed || !WIFEXITED(status) || WEXITSTATUS(status) != 0 || found < reach);
+}
@@ -23,12 +23,17 @@
 #include <memory>
 #include <utility>
 #include <new>
+#include <thread>
+#include <vector>
 #include <unistd.h>
 #include <fcntl.h>
 #include <sys/time.h>
+#include <sys/uio.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/resource.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <time.h>
 #include <netinet/in.h>
 #include <netdb.h>
@@ -36,6 +41,7 @@
 #include "btc-map.h"
 #include "protocol.h"
 #include "filter.h"
+#include "nodemap.h"
 #include "global.h"
 #include "misc.h"
 
@@ -48,25 +54,67 @@ using namespace std;
 namespace hoschi {
 
 
-int btc_node::finish_connect()
+void btc_node::reset(uint32_t id, const node_addr &addr, int sock)
 {
-	if (m_state != STATE_CONNECTING) {
-		m_state = STATE_FAIL;
-		return build_error("finish_connect: wrong state?!", -1);
-	}
+	m_addr = addr;
+	m_id = id;
+	m_name.assign(addr.str());
+	m_err.clear();
+	m_version = 0;
+	m_t_connect = timer_wheel::now_us();
+	m_t_connected = m_t_version_sent = m_t_verack = 0;
+	m_state = STATE_NONE;
+	m_sfd = sock;
+	m_family = addr.family();
+	m_sslen = addr.to_sockaddr(m_ss);
+	m_events = m_io_ready = 0;
+	m_rx.clear();
+	m_tx.clear();
+	if (m_filter)
+		m_filter->clear();
+}
+
+
+void btc_node::release()
+{
+	if (m_sfd >= 0)
+		close(m_sfd);
+	m_sfd = -1;
+	m_state = STATE_NONE;
+	m_rx.trim(numbers::max_pooled_rx);
+	m_tx.clear();
+	if (m_filter)
+		m_filter->clear();
+}
+
 
+int btc_node::finish_connect()
+{
 	int e = 0;
 	socklen_t elen = sizeof(e);
 	if (getsockopt(m_sfd, SOL_SOCKET, SO_ERROR, &e, &elen) < 0) {
 		m_state = STATE_FAIL;
 		return build_error("finish_connect::getsockopt:", -1);
 	}
+
+	return finish_connect(e);
+}
+
+
+int btc_node::finish_connect(int e)
+{
+	if (m_state != STATE_CONNECTING) {
+		m_state = STATE_FAIL;
+		return build_error("finish_connect: wrong state?!", -1);
+	}
+
 	if (e != 0) {
 		m_state = STATE_FAIL; errno = e;
 		return build_error("finish_connect:", -1);
 	}
 
-	if (!(m_filter = new (nothrow) addr_filter(this)))
+	// a recycled node still has its filter
+	if (!m_filter && !(m_filter = new (nothrow) addr_filter(this)))
 		return build_error("finish_connect: OOM", -1);
 
 	return 0;
@@ -76,103 +124,212 @@ int btc_node::finish_connect()
 // 0 on incomplete write, 1 on complete write, -1 on error
 int btc_node::write1()
 {
-	if (m_tx_msg.size() == 0)
+	if (m_tx.empty())
 		return build_error("write1::write: Logic error. Calling write1 w/o message to send", -1);
 
-	string::size_type n = numbers::max_send_size;
-	if (n > m_tx_msg.size())
-		n = m_tx_msg.size();
-	ssize_t r = write(m_sfd, m_tx_msg.c_str(), n);
+	// send as many queued msgs as the kernel takes at once
+	iovec iov[numbers::max_iov];
+	int n = m_tx.iov(iov, numbers::max_iov);
+
+	ssize_t r = writev(m_sfd, iov, n);
 	if (r <= 0) {
-		if (r < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINPROGRESS))
+		if (r < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINPROGRESS)) {
+			m_io_ready &= ~POLLOUT;
 			return 0;
-		return build_error("write1::write:", -1);
+		}
+		return build_error("write1::writev:", -1);
 	}
 
-	m_tx_msg.erase(0, r);
+	m_tx.consume(r);
+	global::stats.inc(metric::bytes_out, r);
 
-	return m_tx_msg.size() == 0;
+	return m_tx.empty();
 }
 
 
-// 0 on incomplete read, 1 on complete read, -1 on error
-int btc_node::read1()
+int btc_node::start_write(reactor *r)
 {
-	char buf[numbers::max_rx_size] = {0};
+	if (m_tx.empty())
+		return build_error("start_write: Logic error. Nothing to send", -1);
 
-	size_t n = sizeof(buf);
-	if (n > m_rx_needed && m_rx_needed > 0)
-		n = m_rx_needed;
+	int n = m_tx.iov(m_iov, numbers::max_iov);
+	if (r->queue_writev(m_sfd, m_iov, n) < 0)
+		return build_error("start_write:" + string(r->why()), -1);
+	return 0;
+}
 
-	// expecting an entirely new packet? only slurp hdr first
-	if (m_rx_needed == 0)
-		n = sizeof(btc_header::header);
 
-	ssize_t r = read(m_sfd, buf, n);
+// like write1(), for the result of a completed writev
+int btc_node::write_done(int r)
+{
+	if (r <= 0) {
+		errno = -r;
+		return build_error("write_done::writev:", -1);
+	}
+
+	m_tx.consume(r);
+	global::stats.inc(metric::bytes_out, r);
+
+	return m_tx.empty();
+}
+
+
+// length of the first complete message in the rx buffer, 0 if there is none yet
+// and -1 if the header announces an insane payload
+ssize_t btc_node::next_msg()
+{
+	if (m_rx.size() < sizeof(btc_header::header))
+		return 0;
+
+	const auto *hdr = reinterpret_cast<const btc_header::header *>(m_rx.data());
+
+	size_t paylen = btctoh32(hdr->paylen);
+	if (paylen > numbers::max_paylen)
+		return -1;
+	if (m_rx.size() < sizeof(btc_header::header) + paylen)
+		return 0;
+	return sizeof(btc_header::header) + paylen;
+}
+
+
+char *btc_node::rx_space()
+{
+	// slurp whatever the kernel has, but make room for at least
+	// the rest of the msg we are waiting for
+	size_t n = numbers::max_rx_size;
+	if (m_rx.size() >= sizeof(btc_header::header)) {
+		size_t need = sizeof(btc_header::header) + btctoh32(reinterpret_cast<const btc_header::header *>(m_rx.data())->paylen);
+		if (need <= numbers::max_paylen + sizeof(btc_header::header) && need - m_rx.size() > n)
+			n = need - m_rx.size();
+	}
+
+	return m_rx.space(n);
+}
+
+
+// 0 on incomplete read, 1 if a complete msg is buffered, -1 on error
+int btc_node::read1()
+{
+	char *buf = rx_space();
+	if (!buf)
+		return build_error("read1: OOM", -1);
+
+	ssize_t r = read(m_sfd, buf, m_rx.room());
 	if (r <= 0) {
 		// this should not happen, as we only get here via POLLIN, but
 		// heavy loaded kernels seem to sometimes mispredict readyness on sockets
 		// Furthermore, it may return EINPROGRESS, even if the manpage doesnt say so
-		if (r < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINPROGRESS))
+		if (r < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINPROGRESS)) {
+			m_io_ready &= ~POLLIN;
 			return 0;
+		}
 		return build_error("read1::read:", -1);
 	}
 
-	m_rx_msg += string(buf, r);
-
-	// have a complete hdr?
-	if (m_rx_msg.size() < sizeof(btc_header::header)) {
-		// we need at minimum a complete header, let rx_ready() tell that if asked
-		m_rx_needed = sizeof(btc_header::header) - m_rx_msg.size();
-		return 0;
-	}
+	m_rx.commit(r);
+	global::stats.inc(metric::bytes_in, r);
 
-	const auto *hdr = reinterpret_cast<const btc_header::header *>(m_rx_msg.c_str());
-
-	if (btctoh32(hdr->paylen) > numbers::max_paylen)
+	ssize_t len = next_msg();
+	if (len < 0)
 		return build_error("read1: Peer wants to send insane large payload", -1);
-	m_rx_needed = sizeof(btc_header::header) + btctoh32(hdr->paylen) - m_rx_msg.size();
 
 	// hdr + payload complete?
-	if (m_rx_needed == 0)
-		return 1;
+	return len > 0;
+}
 
+
+int btc_node::start_read(reactor *r)
+{
+	char *buf = rx_space();
+	if (!buf)
+		return build_error("start_read: OOM", -1);
+
+	// the rx buffer must not be touched until the read completed
+	if (r->queue_read(m_sfd, buf, m_rx.room()) < 0)
+		return build_error("start_read:" + string(r->why()), -1);
 	return 0;
 }
 
 
+// like read1(), for the result of a completed read
+int btc_node::read_done(int r)
+{
+	if (r <= 0) {
+		errno = -r;
+		return build_error("read_done::read:", -1);
+	}
+
+	m_rx.commit(r);
+	global::stats.inc(metric::bytes_in, r);
+
+	ssize_t len = next_msg();
+	if (len < 0)
+		return build_error("read_done: Peer wants to send insane large payload", -1);
+
+	return len > 0;
+}
+
+
+// parse first complete msg from rx buffer and drop it from there
 string btc_node::parse_msg()
 {
 	string reply = "error";
 
+	ssize_t len = next_msg();
+	if (len <= 0) {
+		m_rx.clear();
+		return build_error("parse_msg: No complete message.", reply);
+	}
+
+	const char *msg = m_rx.data();
+
 	btc_header hdr;
-	if (hdr.parse(m_rx_msg) < 0) {
-		m_rx_msg = "";
+	if (hdr.parse(msg, len) < 0) {
+		m_rx.clear();
+		return build_error("parse_msg:" + string(hdr.why()), reply);
+	}
+
+	// drop corrupted or forged payloads before anything looks at them
+	if (config::verify_checksum && hdr.verify(msg, len) < 0) {
+		m_rx.clear();
 		return build_error("parse_msg:" + string(hdr.why()), reply);
 	}
 
 	const string &cmd = hdr.command();
 
-	m_filter->collect(m_version, move(node()), cmd, m_rx_msg);
+	m_filter->collect(m_version, move(node()), cmd, msg, len);
 
 	if (cmd == "version") {
-		if (sizeof(btc_header::header) + sizeof(btc_messages::version) > m_rx_msg.size()) {
-			m_rx_msg = "";
+		if (sizeof(btc_header::header) + sizeof(btc_messages::version) > size_t(len)) {
+			m_rx.clear();
 			return build_error("parse_msg: Version message too short.", reply);;
 		} else {
-			m_version = btctoh32(*reinterpret_cast<const uint32_t *>(m_rx_msg.c_str() + sizeof(btc_header::header)));
+			m_version = btctoh32(*reinterpret_cast<const uint32_t *>(msg + sizeof(btc_header::header)));
+			if (m_t_version_sent)
+				global::stats.observe(metric::version_rtt, timer_wheel::now_us() - m_t_version_sent);
 			reply = make_verack();
 		}
 	} else if (cmd == "verack") {
+		global::stats.inc(metric::handshakes);
+		m_t_verack = timer_wheel::now_us();
 		reply = make_getaddr();
 	} else if (cmd == "addr") {
+		global::stats.inc(metric::addr_msgs);
+		global::stats.observe(metric::addr_bytes, len - sizeof(btc_header::header));
+		if (m_t_verack) {
+			global::stats.observe(metric::addr_wait, timer_wheel::now_us() - m_t_verack);
+			m_t_verack = 0;
+		}
 		reply = "end";
 	} else if (cmd == "ping") {
-		reply = make_pong(m_rx_msg.substr(sizeof(btc_header::header), sizeof(uint64_t)));
+		size_t n = len - sizeof(btc_header::header);
+		if (n > sizeof(uint64_t))
+			n = sizeof(uint64_t);
+		reply = make_pong(msg + sizeof(btc_header::header), n);
 	} else
 		reply = "";
 
-	m_rx_msg = "";
+	m_rx.consume(len);
 	return reply;
 }
 
@@ -181,11 +338,7 @@ int btc_scan::calc_max_fd()
 {
 	// find the highest fd that is in use
 	for (int i = m_max_fd; i >= m_first_fd; --i) {
-		if (m_nodes[i] && m_nodes[i]->state() != STATE_NONE) {
-			m_max_fd = i;
-			return m_max_fd;
-		}
-		if (m_pfds[i].fd != -1) {
+		if (m_nodes[i]) {
 			m_max_fd = i;
 			return m_max_fd;
 		}
@@ -199,21 +352,38 @@ int btc_scan::calc_max_fd()
 int btc_scan::cleanup(int fd, bool can_reconnect)
 {
 	if (m_nodes[fd]) {
+		m_nodes[fd]->session_end(timer_wheel::now_us());
 		m_nodes[fd]->dump_filter();
 		// no more reconnects for this (bad) node
 		if (!can_reconnect) {
-			m_handled_nodes[m_nodes[fd]->node()] = m_reconnects;
+			m_db->retire(m_nodes[fd]->id());
 		} else {
-			global::logger.logit("btcmap:", "Enqueing node " + m_nodes[fd]->node() + " for reconnect.", m_now);
-			m_learned_nodes[m_nodes[fd]->node()] = m_now;
+			LOG_AT(logtag::scan, loglevel::debug, "Enqueing node " + m_nodes[fd]->node() + " for reconnect.", m_now);
+			// not before addr:port may be re-used, as we may use a fixed src port
+			m_db->reconnect(m_nodes[fd]->id(), m_now + m_reconnect_timeout + 1);
 		}
 	}
 
-	delete m_nodes[fd];
+	m_reactor->del(fd);
+	m_timers.disarm(fd);
+
+	if (m_nodes[fd]) {
+		--m_nlive;
+		if (m_reactor->in_flight(fd)) {
+			// the kernel may still write to the node's buffers, so keep the node
+			// and its fd until the cancelled ops completed; shutdown() makes
+			// sure that a read or write which can't be cancelled ends, too
+			m_reactor->cancel(fd);
+			shutdown(fd, SHUT_RDWR);
+			m_parked[fd] = m_nodes[fd];
+			++m_nparked;
+		} else {
+			m_nodes[fd]->release();
+			m_node_pool.put(m_nodes[fd]);
+		}
+	}
 
 	m_nodes[fd] = nullptr;
-	m_pfds[fd].fd = -1;
-	m_pfds[fd].events = m_pfds[fd].revents = 0;
 
 	// not needed: cleanup() will be inside loop and logic says
 	// that you won't save fd's to check calling it here
@@ -225,11 +395,11 @@ int btc_scan::cleanup(int fd, bool can_reconnect)
 }
 
 
-int btc_scan::init(const string &laddr, const string &lport, const string &laddr6, const string &lport6)
+int btc_scan::init(const string &engine, const string &laddr, const string &lport, const string &laddr6, const string &lport6)
 {
 
 	// if not connecting from a fixed port, we don't need to wait timeouts::fin_wait
-	// seconds for a reconnect to the same node
+	// for a reconnect to the same node
 	if (lport.size() == 0 && lport6.size() == 0)
 		m_reconnect_timeout = 2;
 
@@ -248,15 +418,35 @@ int btc_scan::init(const string &laddr, const string &lport, const string &laddr
 			return build_error("init::getrlimit:", -1);
 	}
 
-	if ((m_pfds = new (nothrow) pollfd[rl.rlim_cur]) == nullptr)
-		return build_error("init::new: OOM", -1);
-	memset(m_pfds, 0, sizeof(struct pollfd) * rl.rlim_cur);
-	for (unsigned int i = 0; i < rl.rlim_cur; ++i)
-		m_pfds[i].fd = -1;
+	if ((m_reactor = make_reactor(engine)) == nullptr)
+		return build_error("init: Unknown engine '" + engine + "'.", -1);
+	if (m_reactor->init(rl.rlim_cur) < 0)
+		return build_error("init:" + string(m_reactor->why()), -1);
+
+	if (m_timers.init(rl.rlim_cur) < 0)
+		return build_error("init::timers: OOM", -1);
+
+	// Only whole tokens make a connect, so the burst is split in whole
+	// connects with the remainder going to the first shards. Every shard
+	// needs a burst of at least 1 to connect at all, so with more shards
+	// than -B the total burst is the number of shards.
+	unsigned shards = m_db->shards(), burst = unsigned(config::connect_burst);
+	m_pacer.init(config::connect_rate/shards, burst/shards + (m_shard < burst % shards ? 1 : 0), timer_wheel::now());
+
+	if (config::adaptive) {
+		m_aimd.init(config::min_rate/m_db->shards(), config::max_rate/m_db->shards(), m_pacer.rate(),
+		            config::min_conns/m_db->shards(), config::max_conns/m_db->shards(), timer_wheel::now());
+		m_pacer.rate(m_aimd.rate());
+		m_max_live = m_aimd.conns();
+	}
 
 	if ((m_nodes = new (nothrow) btc_node*[rl.rlim_cur]) == nullptr)
 		return build_error("init::new: OOM", -1);
 	memset(m_nodes, 0, rl.rlim_cur*sizeof(btc_node *));
+	if (m_reactor->completions())
+		m_parked.resize(rl.rlim_cur, nullptr);
+
+	m_node_pool.init(rl.rlim_cur);
 
 	// Now, make the bind addresses ready to later binding when calling connect()
 
@@ -297,355 +487,698 @@ int btc_scan::init(const string &laddr, const string &lport, const string &laddr
 }
 
 
-btc_node *btc_scan::connect(const std::string &ip, const std::string &port)
+btc_node *btc_scan::connect(uint32_t id, const node_addr &node)
 {
 	m_out_of_sockets = 0;
 
-	int r = 0, sock_fd = -1;
-	addrinfo hint, *tai = nullptr;
-	memset(&hint, 0, sizeof(hint));
-	hint.ai_socktype = SOCK_STREAM;
-
-	if ((r = getaddrinfo(ip.c_str(), port.c_str(), &hint, &tai)) < 0)
-		return build_error("connect::getaddrinfo:" + string(gai_strerror(r)), nullptr);
+	int sock_fd = -1, family = node.family();
 
-	free_ptr<addrinfo> ai(tai, freeaddrinfo);
+	sockaddr_storage ss;
+	socklen_t sslen = node.to_sockaddr(ss);
 
-	if (ai->ai_family == AF_INET && !m_baddr)
+	if (family == AF_INET && !m_baddr)
 		return build_error("connect: Not bound to IPv4 socket but IPv4 node requested.", nullptr);
-	if (ai->ai_family == AF_INET6 && !m_baddr6)
+	if (family == AF_INET6 && !m_baddr6)
 		return build_error("connect: Not bound to IPv6 socket but IPv6 node requested.", nullptr);
-	if (ai->ai_family != AF_INET && ai->ai_family != AF_INET6)
-		return build_error("connect: Invalid address family.", nullptr);
 
-	if ((sock_fd = socket(ai->ai_family, SOCK_STREAM, 0)) < 0) {
+	if ((sock_fd = socket(family, SOCK_STREAM|SOCK_NONBLOCK, 0)) < 0) {
 		m_out_of_sockets = 1;
 		return build_error("connect::socket:", nullptr);
 	}
 
-	int flags = fcntl(sock_fd, F_GETFL);
-	fcntl(sock_fd, F_SETFL, flags|O_NONBLOCK);
-
 	int one = 1;
 	setsockopt(sock_fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one));
 	one = 1;
 	setsockopt(sock_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
 
 	// Bind to the right local address (v4 vs. v6) depending on peer node is v4 or v6
-	if (ai->ai_family == AF_INET) {
-		if (::bind(sock_fd, m_baddr->ai_addr, m_baddr->ai_addrlen) < 0)
+	if (family == AF_INET) {
+		if (::bind(sock_fd, m_baddr->ai_addr, m_baddr->ai_addrlen) < 0) {
+			close(sock_fd);
 			return build_error("connect::bind:", nullptr);
-	} else if (ai->ai_family == AF_INET6) {
-		if (::bind(sock_fd, m_baddr6->ai_addr, m_baddr6->ai_addrlen) < 0)
+		}
+	} else {
+		if (::bind(sock_fd, m_baddr6->ai_addr, m_baddr6->ai_addrlen) < 0) {
+			close(sock_fd);
 			return build_error("connect::bind:", nullptr);
-	} else
-		return build_error("connect::bind: Unknown address family.", nullptr);
+		}
+	}
 
-	if (::connect(sock_fd, ai->ai_addr, ai->ai_addrlen) < 0 && errno != EINPROGRESS) {
+	// completion backends connect from the node's copy of the address
+	bool async = m_reactor->completions();
+	if (!async && ::connect(sock_fd, reinterpret_cast<sockaddr *>(&ss), sslen) < 0 && errno != EINPROGRESS) {
 		close(sock_fd);
 		return build_error("connect::connect:", nullptr);
 	}
 
+	btc_node *peer = m_node_pool.get();
+	if (!peer) {
+		close(sock_fd);
+		return build_error("connect: Node pool exhausted or OOM", nullptr);
+	}
 
-	uint16_t portnum = (uint16_t)strtoul(port.c_str(), nullptr, 10);
-
-	unique_ptr<btc_node> peer(new (nothrow) btc_node(ip, portnum, sock_fd, ai->ai_family));
-
-	if (!peer.get())
-		return build_error("connect::new: OOM", nullptr);
+	peer->reset(id, node, sock_fd);
 
 	peer->engine(this);	// who is your parent scan engine?
 	peer->state(STATE_CONNECTING);
-	peer->timer(m_now);
 
-	if (m_first_fd == 0)
+	// other shards share the fd space, so we may see lower fd's later on
+	if (m_first_fd == 0 || sock_fd < m_first_fd)
 		m_first_fd = sock_fd;
 
 	if (sock_fd > m_max_fd)
 		m_max_fd = sock_fd;
 
-	m_pfds[sock_fd].fd = sock_fd;
-	m_pfds[sock_fd].events = POLLIN|POLLOUT;
-	m_pfds[sock_fd].revents = 0;
+	peer->events(POLLIN|POLLOUT);
+	int r = async ? m_reactor->queue_connect(sock_fd, peer->peer_addr(), peer->peer_addr_len()) : m_reactor->add(sock_fd, peer->events());
+	if (r < 0) {
+		peer->release();
+		m_node_pool.put(peer);
+		return build_error("connect:" + string(m_reactor->why()), nullptr);
+	}
+
+	m_timers.arm(sock_fd, config::connect_timeout);
 
-	return peer.release();
+	return peer;
 }
 
 
-btc_node *btc_scan::connect(const std::string &node)
+// keep the FSM's interest mask in sync with the reactor
+void btc_scan::events(int fd, int ev)
 {
-	if (node.find("[") != 0)
-		return build_error("connect: Invalid node format.", nullptr);
+	m_nodes[fd]->events(ev);
+	m_reactor->mod(fd, ev);
+}
 
-	string::size_type pidx = node.find("]:");
-	if (pidx == string::npos)
-		return build_error("connect: Invalid node format.", nullptr);
 
-	string ip = node.substr(1, pidx - 1);
-	string port = node.substr(pidx + 2);
+void btc_scan::check_timeouts()
+{
+	m_timers.expire(timer_wheel::now(), m_expired);
+
+	for (auto i : m_expired) {
+
+		if (!m_nodes[i])
+			continue;
+
+		switch (m_nodes[i]->state()) {
+		case STATE_CONNECTING:
+			LOG_LIMITED(logtag::scan, loglevel::info, "connect timeout on node " + m_nodes[i]->node());
+			global::stats.inc(metric::connects_failed);
+			m_aimd.failure();
+			break;
+		case STATE_SEND_VERSION:
+			LOG_LIMITED(logtag::scan, loglevel::info, "version timeout on node " + m_nodes[i]->node());
+			break;
+		case STATE_GENERIC_READ:
+			LOG_LIMITED(logtag::scan, loglevel::info, "rx_complete timeout on node " + m_nodes[i]->node());
+			break;
+		case STATE_GENERIC_WRITE:
+			LOG_LIMITED(logtag::scan, loglevel::info, "wx_complete timeout on node " + m_nodes[i]->node());
+			break;
+		case STATE_FAIL:
+			break;
+		default:
+			LOG_LIMITED(logtag::scan, loglevel::info, "dead timeout on node " + m_nodes[i]->node());
+		}
+
+		cleanup(i);
+	}
+}
+
+
+// count live nodes per FSM state for the metrics; once a second is plenty
+void btc_scan::publish_live()
+{
+	uint32_t n[metric::max_live] = {0};
 
-	return connect(ip, port);
+	for (int i = m_first_fd; i <= m_max_fd; ++i) {
+		if (!m_nodes[i])
+			continue;
+		switch (m_nodes[i]->state()) {
+		case STATE_CONNECTING:
+			++n[metric::live_connecting];
+			break;
+		case STATE_CONNECTED:
+		case STATE_SEND_VERSION:
+			++n[metric::live_handshake];
+			break;
+		case STATE_GENERIC_READ:
+			++n[metric::live_reading];
+			break;
+		case STATE_GENERIC_WRITE:
+			++n[metric::live_writing];
+			break;
+		default:
+			break;
+		}
+	}
+
+	for (int i = 0; i < metric::max_live; ++i)
+		global::stats.live(m_shard, i, n[i]);
 }
 
 
-btc_node *btc_scan::connect(const string &ip, uint16_t port)
+void btc_scan::adapt_rate()
 {
-	char sport[32] = {0};
-	snprintf(sport, sizeof(sport) - 1, "%hu", port);
-	return connect(ip, sport);
+	uint64_t now = timer_wheel::now();
+
+	if (config::adaptive && m_aimd.update(now)) {
+		char msg[128] = {0};
+		snprintf(msg, sizeof(msg) - 1, "Adapting to %.1f connects/s, %u nodes max (failure ratio %.2f).",
+		         m_aimd.rate(), m_aimd.conns(), m_aimd.ratio());
+		LOG_AT(logtag::scan, loglevel::info, msg, m_now);
+
+		m_pacer.rate(m_aimd.rate());
+		m_max_live = m_aimd.conns();
+	}
+
+	m_pacer.refill(now);
 }
 
 
-int btc_scan::loop()
+// one I/O round on a node for the readiness in ev, and drive the FSM
+// -1 if node was removed, 0 otherwise
+int btc_scan::handle_io(int i, int ev)
 {
 	int r = 0;
+	bool tx_complete = 0, rx_complete = 0;
 
-	for (;;) {
-		if ((r = poll(m_pfds, m_max_fd + 1, 1000)) < 0)
-			continue;
+	if ((ev & POLLIN) && m_nodes[i]->state() != STATE_CONNECTING) {
+		if ((r = m_nodes[i]->read1()) < 0) {
+			LOG_LIMITED(logtag::scan, loglevel::info, "read from node " + m_nodes[i]->node() + " returned error: " + m_nodes[i]->why());
+			cleanup(i);
+			return -1;
+		}
+		// dont re-arm timer here. read1() may return 0 on EINPROGRESS or
+		// on partial reads, so a peer that trickles in bytes would never
+		// hit timeouts::rx_complete
 
-		m_now = time(nullptr);
+		rx_complete = (r == 1);
+	}
 
-		for (int i = m_first_fd; i <= m_max_fd; ++i) {
+	if ((ev & POLLOUT) && m_nodes[i]->state() != STATE_CONNECTING) {
+		if ((r = m_nodes[i]->write1()) < 0) {
+			LOG_LIMITED(logtag::scan, loglevel::info, "write to node " + m_nodes[i]->node() + " returned error: " + m_nodes[i]->why());
+			cleanup(i);
+			return -1;
+		}
 
-			if (!m_nodes[i] || m_pfds[i].fd == -1)
-				continue;
+		// see above
 
-			if (m_pfds[i].revents == 0) {
-				if (m_nodes[i]->state() == STATE_CONNECTING && m_now - m_nodes[i]->timer() > timeouts::connect) {
-					global::logger.logit("btcmap:", "connect timeout on node " + m_nodes[i]->node(), m_now);
-					cleanup(i);
-				} else if (m_now - m_nodes[i]->timer() > timeouts::dead) {
-					global::logger.logit("btcmap:", "dead timeout on node " + m_nodes[i]->node(), m_now);
-					cleanup(i);
-				} else if (m_nodes[i]->state() == STATE_FAIL)
-					cleanup(i);
+		tx_complete = (r == 1);
+	}
 
-				continue;
-			}
+	return advance(i, tx_complete, rx_complete);
+}
 
-			if ((m_pfds[i].revents & ~(POLLIN|POLLOUT)) != 0 || m_nodes[i]->state() == STATE_FAIL) {
-				global::logger.logit("btcmap:", "poll error on node " + m_nodes[i]->node());
-				cleanup(i);
-				continue;
-			}
 
-			bool tx_complete = 0, rx_complete = 0;
+// The FSM, after the I/O of a node completed a write or read or neither.
+// Each state arms the node timer with its timeout, and expiry is handled
+// in check_timeouts(). -1 if node was removed, 0 otherwise
+int btc_scan::advance(int i, bool tx_complete, bool rx_complete)
+{
+	switch (m_nodes[i]->state()) {
+	case STATE_NONE:
+		break;
+	case STATE_CONNECTING:
+		if (m_nodes[i]->finish_connect() < 0) {
+			LOG_LIMITED(logtag::scan, loglevel::info, "error when finish_connect on node " + m_nodes[i]->node());
+			global::stats.inc(metric::connects_failed);
+			cleanup(i);
+			return -1;
+		}
+		global::stats.inc(metric::connects_ok);
+		m_nodes[i]->connected(timer_wheel::now_us());
+		m_nodes[i]->state(STATE_CONNECTED);
+	// fallthrough
+	case STATE_CONNECTED:
+		LOG_AT(logtag::scan, loglevel::debug, "connected to node " + m_nodes[i]->node(), m_now);
+		m_nodes[i]->queue_msg(make_version(m_nodes[i]->addr()));
+		m_timers.arm(i, timeouts::tx_complete);
+		m_nodes[i]->state(STATE_SEND_VERSION);
+		events(i, POLLOUT);
+		break;
+	case STATE_SEND_VERSION:
+		if (tx_complete) {
+			m_nodes[i]->version_sent(timer_wheel::now_us());
+			m_timers.arm(i, timeouts::verack);
+			m_nodes[i]->state(STATE_GENERIC_READ);
+			events(i, POLLIN);	// expect verack
+		}
+		break;
+	// Keep on reading while replies are still being sent, so a handshake
+	// doesn't wait for one msg after the other.
+	case STATE_GENERIC_READ:
+	case STATE_GENERIC_WRITE:
+		if (tx_complete) {
+			m_timers.arm(i, timeouts::rx_complete);
+			m_nodes[i]->state(STATE_GENERIC_READ);
+			events(i, POLLIN);
+		}
 
-			if (m_pfds[i].revents & POLLIN) {
-				if ((r = m_nodes[i]->read1()) < 0) {
-					global::logger.logit("btcmap:", "read from node " + m_nodes[i]->node() + " returned error: " + m_nodes[i]->why(), m_now);
-					cleanup(i);
-					continue;
-				}
-				// dont update timer here. read1() may return 0 on EINPROGRESS,
-				// so we need to check against timeouts::rx_complete and in order to
-				// do that later, we can't update time here
-				//m_nodes[i]->timer(m_now);
+		if (rx_complete) {
+			m_timers.arm(i, timeouts::rx_complete);
 
-				rx_complete = (r == 1);
-			}
+			bool had_version = m_nodes[i]->version() != 0;
 
-			if ((m_pfds[i].revents & POLLOUT) && m_nodes[i]->state() != STATE_CONNECTING) {
-				if ((r = m_nodes[i]->write1()) < 0) {
-					global::logger.logit("btcmap:", "write to node " + m_nodes[i]->node() + " returned error: " + m_nodes[i]->why(), m_now);
+			// parse all msgs that arrived with this read, e.g. version + verack + ping,
+			// and queue their replies so they go out with one writev()
+			do {
+				string reply = m_nodes[i]->parse_msg();
+				if (reply == "error") {
+					LOG_LIMITED(logtag::scan, loglevel::info, "parse_msg() returned error on node " + m_nodes[i]->node() + ": " + m_nodes[i]->why());
 					cleanup(i);
-					continue;
+					return -1;
+				} else if (reply == "end") {
+					// make node re-usable for re-connect and let main connect loop decide about
+					// actually doing the reconnect or removal of inode based on connect-count
+					cleanup(i, 1);
+					return -1;
 				}
+				m_nodes[i]->queue_msg(move(reply));
+			} while (m_nodes[i]->has_msg());
 
-				// see above
-				//m_nodes[i]->timer(m_now);
+			if (!had_version && m_nodes[i]->version() != 0)
+				m_aimd.success();
 
-				tx_complete = (r == 1);
+			if (!m_nodes[i]->tx_ready() && m_nodes[i]->state() != STATE_GENERIC_WRITE) {
+				m_timers.arm(i, timeouts::tx_complete);
+				m_nodes[i]->state(STATE_GENERIC_WRITE);
+				events(i, POLLIN|POLLOUT);
 			}
+		}
+		break;
+	case STATE_FAIL:
+		cleanup(i);
+		return -1;
+	}
 
-			m_pfds[i].revents = 0;
+	return 0;
+}
 
-			// The FSM
-			switch (m_nodes[i]->state()) {
-			case STATE_NONE:
-				continue;
-			case STATE_CONNECTING:
-				if (m_nodes[i]->finish_connect() < 0) {
-					global::logger.logit("btcmap:", "error when finish_connect on node " + m_nodes[i]->node());
-					cleanup(i);
-					break;
-				}
-				m_nodes[i]->state(STATE_CONNECTED);
-			// fallthrough
-			case STATE_CONNECTED:
-				global::logger.logit("btcmap:", "connected to node " + m_nodes[i]->node(), m_now);
-				m_nodes[i]->set_msg(make_version(m_nodes[i]->node()));
-				m_nodes[i]->timer(m_now);
-				m_nodes[i]->state(STATE_SEND_VERSION);
-				m_pfds[i].events = POLLOUT;
-				break;
-			case STATE_SEND_VERSION:
-				if (tx_complete) {
-					m_nodes[i]->timer(m_now);
-					m_nodes[i]->state(STATE_GENERIC_READ);
-					m_pfds[i].events = POLLIN;	// expect verack
-				} else if (m_now - m_nodes[i]->timer() > timeouts::tx_complete) {
-					global::logger.logit("btcmap:", "verack timeout on node " + m_nodes[i]->node(), m_now);
-					cleanup(i);
-				}
-				break;
-			case STATE_GENERIC_READ:
-				if (rx_complete) {
-					m_pfds[i].events = POLLIN;
-					m_nodes[i]->timer(m_now);
-
-					string reply = m_nodes[i]->parse_msg();
-					if (reply == "error") {
-						global::logger.logit("btcmap:", "parse_msg() returned error on node " + m_nodes[i]->node() + ": " + m_nodes[i]->why(), m_now);
-						cleanup(i);
-						break;
-					} else if (reply == "end") {
-						// make node re-usable for re-connect and let main connect loop decide about
-						// actually doing the reconnect or removal of inode based on connect-count
-						cleanup(i, 1);
-						break;
-					}
-
-					if (reply.size() > 0) {
-						m_nodes[i]->state(STATE_GENERIC_WRITE);
-						m_nodes[i]->set_msg(reply);
-						m_pfds[i].events = POLLOUT;
-					}
-				} else if (m_now - m_nodes[i]->timer() > timeouts::rx_complete) {
-					global::logger.logit("btcmap:", "rx_complete timeout on node " + m_nodes[i]->node(), m_now);
-					cleanup(i);
-				}
-				break;
-			case STATE_GENERIC_WRITE:
-				if (tx_complete) {
-					m_nodes[i]->timer(m_now);
-					m_nodes[i]->state(STATE_GENERIC_READ);
-					m_pfds[i].events = POLLIN;
-				} else if (m_now - m_nodes[i]->timer() > timeouts::tx_complete) {
-					global::logger.logit("btcmap:", "wx_complete timeout on node " + m_nodes[i]->node());
-					cleanup(i);
-				}
-				break;
-			case STATE_FAIL:
-				cleanup(i);
-				break;
-			}
+
+// handle readiness reported by the reactor for a node
+// -1 if node was removed, 1 if it still has pending readiness, 0 otherwise
+int btc_scan::handle(int i, int revents)
+{
+	if (!m_nodes[i])
+		return -1;
+
+	if ((revents & ~(POLLIN|POLLOUT)) != 0 || m_nodes[i]->state() == STATE_FAIL) {
+		LOG_LIMITED(logtag::scan, loglevel::info, "poll error on node " + m_nodes[i]->node());
+		if (m_nodes[i]->state() == STATE_CONNECTING)
+			global::stats.inc(metric::connects_failed);
+		m_aimd.failure();
+		cleanup(i);
+		return -1;
+	}
+
+	// level triggered backends report again on next wait
+	if (!m_reactor->edge_triggered()) {
+		m_nodes[i]->io_ready(revents);
+		return handle_io(i, revents & m_nodes[i]->events());
+	}
+
+	// Edge triggered: readiness is latched until read1()/write1() see EAGAIN, so
+	// do I/O as long as the FSM wants what is ready. Limit the rounds so a
+	// single busy node can't starve the others.
+	m_nodes[i]->io_ready(m_nodes[i]->io_ready() | revents);
+
+	for (int round = 0; round < numbers::max_io_rounds; ++round) {
+		int ev = m_nodes[i]->io_ready() & m_nodes[i]->events();
+		if (!ev)
+			return 0;
+		if (handle_io(i, ev) < 0)
+			return -1;
+	}
+
+	return (m_nodes[i]->io_ready() & m_nodes[i]->events()) != 0;
+}
+
+
+// completion backends: queue the reads and writes the FSM waits for, unless
+// they are in flight already; -1 if node was removed, 0 otherwise
+int btc_scan::submit(int i)
+{
+	btc_node *bn = m_nodes[i];
+	int busy = m_reactor->in_flight(i), ev = bn->events();
+
+	if ((ev & POLLOUT) && !(busy & POLLOUT) && !bn->tx_ready() && bn->start_write(m_reactor) < 0) {
+		LOG_LIMITED(logtag::scan, loglevel::info, "write to node " + bn->node() + " returned error: " + bn->why());
+		cleanup(i);
+		return -1;
+	}
+	if ((ev & POLLIN) && !(busy & POLLIN) && bn->start_read(m_reactor) < 0) {
+		LOG_LIMITED(logtag::scan, loglevel::info, "read from node " + bn->node() + " returned error: " + bn->why());
+		cleanup(i);
+		return -1;
+	}
+	return 0;
+}
+
+
+// handle a completed connect, read or write of a node
+// -1 if node was removed, 0 otherwise
+int btc_scan::complete(const reactor::event &ev)
+{
+	int i = ev.fd, r = 0;
+
+	// the last op of a parked node gives it back to the pool
+	if (m_parked[i]) {
+		if (!m_reactor->in_flight(i)) {
+			m_parked[i]->release();
+			m_node_pool.put(m_parked[i]);
+			m_parked[i] = nullptr;
+			--m_nparked;
 		}
+		return -1;
+	}
 
-		int cnt = 0, max_connects = 256;
-		for (auto it = m_learned_nodes.begin(); it != m_learned_nodes.end() && cnt < max_connects;) {
+	btc_node *bn = m_nodes[i];
+	if (!bn)
+		return -1;
 
-			// reconnects are put into m_learned_nodes again by FSM, so check if a sock/bind/connect would make sense
-			// in terms of addr:port re-use (we may used fixed src port). The initial 'time' (->second)
-			// when learning the node is set to 1, so this will work with newly learned nodes as well.
-			// the FSM sets this field to "time of closing"
-			if (m_now - it->second <= m_reconnect_timeout) {
-				++it;
-				continue;
-			}
+	bool tx_complete = 0, rx_complete = 0;
+
+	if (bn->state() == STATE_CONNECTING) {
+		if (bn->finish_connect(ev.res < 0 ? -ev.res : 0) < 0) {
+			LOG_LIMITED(logtag::scan, loglevel::info, "error when finish_connect on node " + bn->node() + ": " + bn->why());
+			global::stats.inc(metric::connects_failed);
+			m_aimd.failure();
+			cleanup(i);
+			return -1;
+		}
+		global::stats.inc(metric::connects_ok);
+		bn->connected(timer_wheel::now_us());
+		bn->state(STATE_CONNECTED);
+	} else if (ev.events & POLLIN) {
+		if ((r = bn->read_done(ev.res)) < 0) {
+			LOG_LIMITED(logtag::scan, loglevel::info, "read from node " + bn->node() + " returned error: " + bn->why());
+			cleanup(i);
+			return -1;
+		}
+		rx_complete = (r == 1);
+	} else {
+		if ((r = bn->write_done(ev.res)) < 0) {
+			LOG_LIMITED(logtag::scan, loglevel::info, "write to node " + bn->node() + " returned error: " + bn->why());
+			cleanup(i);
+			return -1;
+		}
+		tx_complete = (r == 1);
+	}
+
+	if (advance(i, tx_complete, rx_complete) < 0)
+		return -1;
+	return submit(i);
+}
+
+
+int btc_scan::loop()
+{
+	vector<reactor::event> ready;
+	vector<int> pending;
+
+	for (;;) {
+		// if there are nodes left over from last round, dont block. Otherwise
+		// wake up for the next timer, or the next connect token if nodes are waiting
+		int timeout = m_timers.next_timeout(1000);
+		if (m_pending.size() > 0)
+			timeout = 0;
+		else if (m_db->queued() > 0 && m_pacer.available(1) == 0)
+			timeout = m_pacer.next_token(timeout);
+
+		if (m_reactor->wait(ready, timeout) < 0)
+			continue;
+
+		if (time(nullptr) != m_now)
+			publish_live();
+		m_now = time(nullptr);
+
+		pending.clear();
+		pending.swap(m_pending);
+
+		for (const auto &ev : ready) {
+			if (m_reactor->completions())
+				complete(ev);
+			else if (handle(ev.fd, ev.events) == 1)
+				m_pending.push_back(ev.fd);
+		}
+
+		// fd's may have been re-used by now, but then the new node has no latched
+		// readiness and handle() is a no-op
+		for (auto fd : pending) {
+			if (handle(fd, 0) == 1)
+				m_pending.push_back(fd);
+		}
+
+		check_timeouts();
+
+		// connect() also sets correct state for FSM. Nodes that we can't connect because we are
+		// out of fd's for a periode are given back to the frontier. Only take as many as the
+		// pacer allows right now, the rest waits for later rounds.
+		adapt_rate();
+
+		uint32_t n = m_pacer.available(numbers::max_connects);
+		if (m_nlive >= m_max_live)
+			n = 0;
+		else if (n > m_max_live - m_nlive)
+			n = m_max_live - m_nlive;
+
+		m_db->take(m_shard, m_now, n, m_candidates);
+
+		for (size_t k = 0; k < m_candidates.size(); ++k) {
+
+			const node_addr &node = m_candidates[k].node;
+
+			m_pacer.take();
 
-			const string &node = it->first;
+			if (m_candidates[k].handled == 0)
+				LOG_DEBUG(logtag::scan, "Trying 1st connect to node " + node.str());
+			else
+				LOG_DEBUG(logtag::scan, "Trying reconnect to node " + node.str());
 
 			btc_node *bn = nullptr;
 
-			auto h_it = m_handled_nodes.find(node);
-
-			// connect() also sets correct state for FSM. Keep node in learned_nodes map if we
-			// have trial-connect errors, since we may be out of fd'd for a periode
-			if (h_it == m_handled_nodes.end() || h_it->second < m_reconnects) {
-
-				usleep(15000);
-
-				if (h_it == m_handled_nodes.end())
-					global::logger.logit("btcmap:", "Trying 1st connect to node " + node);
-				else
-					global::logger.logit("btcmap:", "Trying reconnect to node " + node);
-
-				if ((bn = connect(node))) {
-					m_nodes[bn->sock()] = bn;
-					++m_handled_nodes[node];
-					++cnt;
-				} else {
-					if (out_of_sockets()) {
-						global::logger.logit("btcmap:", "Out of file descriptors.", m_now);
-						break;
-					} else
-						global::logger.logit("btcmap:", "Connect error on node " + node + " :" + string(this->why()));
-				}
-			} else if (h_it != m_handled_nodes.end() && h_it->second >= m_reconnects)
-				global::logger.logit("btcmap:", "Node " + node + " reached max reconnect count. Not handling again.", m_now);
+			bn = connect(m_candidates[k].id, node);
+			if (bn || !out_of_sockets()) {
+				global::stats.inc(metric::connects);
+				if (m_candidates[k].handled > 0)
+					global::stats.inc(metric::reconnects);
+			}
 
-			it = m_learned_nodes.erase(it);
+			if (bn) {
+				m_nodes[bn->sock()] = bn;
+				++m_nlive;
+			} else if (out_of_sockets()) {
+				LOG_LIMITED(logtag::scan, loglevel::warn, "Out of file descriptors.");
+				m_aimd.failure();
+				for (; k < m_candidates.size(); ++k)
+					m_db->give_back(m_candidates[k].id, 1);
+				break;
+			} else {
+				LOG_LIMITED(logtag::scan, loglevel::info, "Connect error on node " + node.str() + " :" + string(this->why()));
+				global::stats.inc(metric::connects_failed);
+				m_aimd.failure();
+				m_db->give_back(m_candidates[k].id, 0);
+			}
 		}
 
 		// nothing more to scan?
-		if (calc_max_fd() == -1 && m_learned_nodes.size() == 0)
+		if (calc_max_fd() == -1 && m_nparked == 0 && m_db->done())
 			break;
 	}
 
+	publish_live();
+
+	auto ps = m_node_pool.occupancy();
+	char msg[128] = {0};
+	snprintf(msg, sizeof(msg) - 1, "Node pool of shard %u: %zu in use, %zu peak, %zu allocated, %zu capacity.",
+	         m_shard, ps.in_use, ps.peak, ps.allocated, ps.capacity);
+	LOG_AT(logtag::scan, loglevel::info, msg, m_now);
+
 	return 0;
 }
 
 
-int btc_scan::restore_nodes(const string &path)
+int btc_scan::seed_nodes(const map<string, int> &seeds)
 {
-	free_ptr<FILE> f(fopen(path.c_str(), "r"), [](FILE *fp){fclose(fp);});
-	if (!f.get())
-		return build_error("restore_nodes:", -1);
+	node_addr node;
 
-	const int lsize = 0x10000;
-	unique_ptr<char[]> buf(new (nothrow) char[lsize]);
-	if (!buf.get())
-		return build_error("restore_nodes: OOM",  -1);
+	for (const auto &it : seeds) {
+		if (node.from_str(it.first) < 0)
+			return build_error("seed_nodes: Invalid node format '" + it.first + "'.", -1);
+		// seeds are up and serve the chain for sure
+		learn_node(node, time(nullptr), numbers::node_network);
+	}
 
-	string::size_type comma = 0;
-	for (;!feof(f.get());) {
-		memset(buf.get(), 0, lsize);
-		if (!fgets(buf.get(), lsize - 1, f.get()))
-			break;
-		string line = buf.get();
+	return 0;
+}
 
-		// replace newline by comma to have easier search loop to split off nodes later
-		if (line.size() < 5)
-			continue;
-		if (line[line.size() - 1] == '\n')
-			line[line.size() - 1] = ',';
-		else
-			line += ",";
 
-		if ((comma = line.find(",")) == string::npos)
+// run f(0) .. f(n - 1) on threads of their own and wait for all of them
+template<class F>
+static void in_parallel(size_t n, F f)
+{
+	vector<thread> workers;
+	for (size_t i = 1; i < n; ++i)
+		workers.emplace_back(f, i);
+	f(0);
+	for (auto &w : workers)
+		w.join();
+}
+
+
+// one thread per min_restore_chunk bytes of work, but not more than cores
+static size_t restore_threads(uint64_t work)
+{
+	size_t n = thread::hardware_concurrency();
+	if (n == 0)
+		n = 1;
+	if (n > work/numbers::min_restore_chunk + 1)
+		n = work/numbers::min_restore_chunk + 1;
+	return n;
+}
+
+
+// The part of a text nodemap that one thread parses. The nodes we connected
+// to are kept once per line, as that counts the connects. Advertised nodes
+// are only kept once per chunk.
+struct restore_chunk {
+	const char *begin{nullptr}, *end{nullptr};
+	std::vector<node_addr> handled;
+	node_table learned;
+};
+
+
+static void parse_chunk(restore_chunk &c)
+{
+	node_addr node;
+	uint32_t version = 0;
+	vector<node_addr> addrs;
+
+	for (const char *s = c.begin, *nl = nullptr; s < c.end; s = nl + 1) {
+		if (!(nl = static_cast<const char *>(memchr(s, '\n', c.end - s))))
+			nl = c.end;
+		if (parse_nodemap_line(s, nl - s, node, version, addrs) < 0)
 			continue;
+		c.handled.push_back(node);
+		for (const auto &a : addrs)
+			c.learned.insert(a, a.hash());
+	}
+}
 
-		string node = line.substr(0, comma);
 
-		if (m_handled_nodes.count(node) == 0) {
-			m_handled_nodes.emplace(node, 1);
-			global::logger.logit("restore_nodes:", "Adding " + node + " to list of handled nodes.");
-		} else
-			++m_handled_nodes[node];
+int btc_scan::restore_text(const string &path)
+{
+	int fd = open(path.c_str(), O_RDONLY|O_CLOEXEC);
+	if (fd < 0)
+		return build_error("restore_text: open", -1);
+
+	struct stat st;
+	if (fstat(fd, &st) < 0) {
+		close(fd);
+		return build_error("restore_text: fstat", -1);
+	}
+	if (st.st_size == 0) {
+		close(fd);
+		return 0;
+	}
+
+	void *map = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return build_error("restore_text: mmap", -1);
+	madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+	const char *data = static_cast<const char *>(map), *end = data + st.st_size;
+
+	// split at line boundaries after equal shares of the file
+	vector<restore_chunk> chunks(restore_threads(st.st_size));
+	const char *b = data;
+	for (size_t i = 0; i < chunks.size(); ++i) {
+		const char *e = data + (i + 1)*st.st_size/chunks.size();
+		if (e < b)
+			e = b;
+		if (e < end) {
+			const char *nl = static_cast<const char *>(memchr(e, '\n', end - e));
+			e = nl ? nl + 1 : end;
+		}
+		chunks[i].begin = b;
+		chunks[i].end = b = e;
+	}
 
-		// skip version=...,
-		if (line.find("version=", comma) != string::npos)
-			comma = line.find(",", comma + 1);
-		// skip agent=...,
-		if (line.find("agent=", comma) != string::npos)
-			comma = line.find(",", comma + 1);
+	in_parallel(chunks.size(), [&chunks](size_t i){ parse_chunk(chunks[i]); });
+	munmap(map, st.st_size);
 
-		for (auto prev = comma + 1; prev < line.size();) {
-			if ((comma = line.find(",", prev)) == string::npos)
-				break;
-			if (comma - prev < 5)
-				continue;
-			node = line.substr(prev, comma - prev - 1);
-			if (m_handled_nodes.count(node) == 0 || m_handled_nodes[node] < m_reconnects) {
-				m_learned_nodes.emplace(node, 1);
-				global::logger.logit("restore_nodes:", "Adding " + node + " to list of learned nodes.");
-			}
-			prev = comma + 1;
+	node_db *db = m_db;
+
+	// all handled ones first, so none of them is queued as learned before
+	in_parallel(chunks.size(), [db, &chunks](size_t i){
+		for (const auto &n : chunks[i].handled)
+			db->restore_handled(n);
+	});
+	in_parallel(chunks.size(), [db, &chunks](size_t i){
+		for (uint32_t j = 0; j < chunks[i].learned.size(); ++j)
+			db->restore_learned(chunks[i].learned.at(j));
+	});
+
+	size_t lines = 0;
+	for (const auto &c : chunks)
+		lines += c.handled.size();
+
+	LOG_INFO(logtag::restore, "Restored " + to_string(lines) + " connects from " + path +
+	         " with " + to_string(chunks.size()) + " threads.");
+	return 0;
+}
+
+
+int btc_scan::restore_nodemap(const string &path)
+{
+	nodemap nm;
+	if (nm.open(path) < 0)
+		return build_error(string("restore_nodemap: ") + nm.why(), -1);
+
+	node_db *db = m_db;
+	nodemap *pnm = &nm;
+	size_t n = restore_threads(nm.size()*sizeof(nodemap_record) + nm.edges()*sizeof(uint32_t));
+
+	// all handled ones first, so none of them is queued as learned before
+	in_parallel(n, [db, pnm, n](size_t t){
+		for (uint64_t i = t*pnm->size()/n; i < (t + 1)*pnm->size()/n; ++i) {
+			for (uint16_t j = le16toh(pnm->at(i).scans); j > 0; --j)
+				db->restore_handled(pnm->at(i).addr);
+		}
+	});
+	// most nodes are advertised many times, but need to be learned only once
+	vector<uint8_t> advertised(nm.size(), 0);
+	for (uint64_t i = 0; i < nm.edges(); ++i)
+		advertised[le32toh(nm.edge(i))] = 1;
+
+	in_parallel(n, [db, pnm, n, &advertised](size_t t){
+		for (uint64_t i = t*pnm->size()/n; i < (t + 1)*pnm->size()/n; ++i) {
+			if (advertised[i])
+				db->restore_learned(pnm->at(i).addr);
 		}
+	});
+
+	LOG_INFO(logtag::restore, "Restored " + to_string(nm.size()) + " nodes and " +
+	         to_string(nm.edges()) + " advertisements from " + path + " with " + to_string(n) + " threads.");
+	return 0;
+}
+
+
+int btc_scan::restore_nodes(const string &path)
+{
+	uint64_t start = timer_wheel::now();
+
+	int r = nodemap::probe(path) ? restore_nodemap(path) : restore_text(path);
+	if (r < 0) {
+		LOG_ERROR(logtag::restore, m_err);
+		return r;
 	}
 
+	LOG_INFO(logtag::restore, "Ready after " + to_string(timer_wheel::now() - start) + "ms with " +
+	         to_string(m_db->size()) + " nodes.");
 	return 0;
 }
 
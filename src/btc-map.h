@@ -24,6 +24,7 @@
 #include <string>
 #include <cstring>
 #include <map>
+#include <vector>
 #include <time.h>
 #include <cstdint>
 #include <cerrno>
@@ -34,6 +35,14 @@
 #include <netinet/in.h>
 #include <netdb.h>
 #include "filter.h"
+#include "buffer.h"
+#include "node-addr.h"
+#include "reactor.h"
+#include "node-db.h"
+#include "timer.h"
+#include "pacer.h"
+#include "pool.h"
+#include "config.h"
 #include "global.h"
 #include "misc.h"
 
@@ -55,26 +64,48 @@ enum btc_states : int32_t {
 
 class btc_node {
 
-	std::string m_ip{""}, m_sport{""}, m_sversion{""}, m_err{""};
-	std::string m_rx_msg{""}, m_tx_msg{""};
+	std::string m_sversion{""}, m_err{""};
 
-	// how many bytes left until a received msg is complete?
-	uint32_t m_rx_needed{0};
+	node_addr m_addr;
+
+	// ID in the node_db
+	uint32_t m_id{0};
+
+	// "[ip]:port", only for logging and dumping
+	std::string m_name{""};
+
+	// received data, may hold several msgs
+	rx_buffer m_rx;
+
+	// msgs waiting to be sent
+	tx_queue m_tx;
 
 	uint32_t m_version{0};
-	uint16_t m_port{0};
+
+	// in us, for the latency histograms; 0 if not there yet
+	uint64_t m_t_connect{0}, m_t_connected{0}, m_t_version_sent{0}, m_t_verack{0};
 
 	btc_states m_state{STATE_NONE};
 
 	int m_sfd{-1}, m_family{AF_INET};
 
-	time_t m_last_access{0};
+	// completion backends read these while the connect or write is in flight
+	sockaddr_storage m_ss;
+	socklen_t m_sslen{0};
+	iovec m_iov[numbers::max_iov];
+
+	// which POLLIN/POLLOUT the FSM waits for, and which readiness has been
+	// reported but not yet consumed by an EAGAIN
+	int m_events{0}, m_io_ready{0};
 
 	filter *m_filter{nullptr};
 
 	// no ownership, just a pointer to existing parent to lookup some things
 	class btc_scan *m_parent_engine{nullptr};
 
+	// room in the rx buffer for the next read, nullptr on OOM
+	char *rx_space();
+
 	template<class T>
 	T build_error(const std::string &msg, T r)
 	{
@@ -91,14 +122,16 @@ class btc_node {
 
 public:
 
-	btc_node(const std::string &ip, uint16_t port, int sock, int family)
-		: m_ip(ip), m_port(port), m_sfd(sock), m_family(family)
+	// nodes live in a slab_pool and are set up by reset() for each connect
+	btc_node()
 	{
-		char tmp[32] = {0};
-		snprintf(tmp, sizeof(tmp) - 1, "%hu", port);
-		m_sport = tmp;
 	}
 
+	void reset(uint32_t, const node_addr &, int);
+
+	// connection is done; close socket but keep buffers and filter for the next one
+	void release();
+
 	void engine(btc_scan *e)
 	{
 		m_parent_engine = e;
@@ -112,64 +145,107 @@ public:
 	virtual ~btc_node()
 	{
 		delete m_filter;
-		close(m_sfd);
+		if (m_sfd >= 0)
+			close(m_sfd);
 	}
 
-	time_t timer()
+	btc_states state()
 	{
-		return m_last_access;
+		return m_state;
 	}
 
-	void timer(time_t t)
+	void state(btc_states s)
 	{
-		m_last_access = t;
+		m_state = s;
 	}
 
-	btc_states state()
+	int events()
 	{
-		return m_state;
+		return m_events;
 	}
 
-	void state(btc_states s)
+	void events(int ev)
 	{
-		m_state = s;
+		m_events = ev;
 	}
 
-	std::string node()
+	int io_ready()
 	{
-		return "[" + m_ip + "]:" + m_sport;
+		return m_io_ready;
 	}
 
-	std::string ip()
+	void io_ready(int ev)
 	{
-		return m_ip;
+		m_io_ready = ev;
 	}
 
-	int finish_connect();
+	const std::string &node()
+	{
+		return m_name;
+	}
 
-	int sock()
+	const node_addr &addr()
 	{
-		return m_sfd;
+		return m_addr;
+	}
+
+	uint32_t id()
+	{
+		return m_id;
+	}
+
+	// the peer's protocol version, 0 until its version message arrived
+	uint32_t version()
+	{
+		return m_version;
+	}
+
+	// TCP connect completed at t
+	void connected(uint64_t t)
+	{
+		m_t_connected = t;
+		global::stats.observe(metric::connect_rtt, t - m_t_connect);
 	}
 
-	void set_msg(const std::string &m)
+	void version_sent(uint64_t t)
 	{
-		m_tx_msg = m;
+		m_t_version_sent = t;
 	}
 
-	std::string get_msg()
+	// lifetime from connect() on, if it was ever connected
+	void session_end(uint64_t t)
+	{
+		if (m_t_connected)
+			global::stats.observe(metric::session, t - m_t_connect);
+	}
+
+	// readiness backends take the result of the connect from SO_ERROR
+	int finish_connect();
+
+	// 0 or the errno of the connect
+	int finish_connect(int);
+
+	int sock()
 	{
-		return m_rx_msg;
+		return m_sfd;
+	}
+
+	void queue_msg(std::string &&m)
+	{
+		m_tx.push(std::move(m));
 	}
 
 	int tx_ready()
 	{
-		return m_tx_msg.size() == 0;
+		return m_tx.empty();
 	}
 
-	int rx_ready()
+	ssize_t next_msg();
+
+	// is there another complete msg in the rx buffer?
+	bool has_msg()
 	{
-		return m_rx_needed == 0;
+		return next_msg() > 0;
 	}
 
 	std::string parse_msg();
@@ -180,6 +256,27 @@ public:
 	// rcv one btc message
 	int read1();
 
+	// Completion backends: queue a write of what is in the tx queue, or a
+	// read into the rx buffer, and take the result like write1()/read1()
+	// would return it.
+	int start_write(reactor *);
+
+	int write_done(int);
+
+	int start_read(reactor *);
+
+	int read_done(int);
+
+	const sockaddr *peer_addr()
+	{
+		return reinterpret_cast<const sockaddr *>(&m_ss);
+	}
+
+	socklen_t peer_addr_len()
+	{
+		return m_sslen;
+	}
+
 	int dump_filter()
 	{
 		if (m_filter)
@@ -198,18 +295,44 @@ class btc_scan {
 
 	std::string m_err{""};
 
-	std::map<std::string, time_t> m_handled_nodes, m_learned_nodes;
+	// shared with the other shards, no ownership
+	node_db *m_db{nullptr};
+
+	unsigned m_shard{0};
+
+	std::vector<node_db::candidate> m_candidates;
 
 	bool m_out_of_sockets{0};
 
-	pollfd *m_pfds{nullptr};
+	reactor *m_reactor{nullptr};
 	btc_node **m_nodes{nullptr};
 
+	// fd's of nodes that still have pending readiness after their I/O rounds
+	std::vector<int> m_pending;
+
+	// completion backends: nodes that are done, but whose cancelled ops did
+	// not complete yet; they keep their fd so it can't be reused meanwhile
+	std::vector<btc_node *> m_parked;
+	uint32_t m_nparked{0};
+
 	int m_first_fd{0}, m_max_fd{-1};
 
-	uint32_t m_reconnects{numbers::btc_reconnects};
+	time_t m_now{0}, m_reconnect_timeout{timeouts::fin_wait/1000};
+
+	// node timeouts, indexed by fd
+	timer_wheel m_timers;
+
+	std::vector<int> m_expired;
+
+	slab_pool<btc_node> m_node_pool;
 
-	time_t m_now{0}, m_reconnect_timeout{timeouts::fin_wait};
+	// this shard's part of the connect rate
+	token_bucket m_pacer;
+
+	aimd_controller m_aimd;
+
+	// live nodes and their ceiling
+	uint32_t m_nlive{0}, m_max_live{0xffffffff};
 
 	addrinfo *m_baddr{nullptr}, *m_baddr6{nullptr};
 
@@ -231,17 +354,35 @@ class btc_scan {
 
 	int cleanup(int, bool can_reconnect = 0);
 
-	btc_node *connect(const std::string &ip, const std::string &port);
+	void events(int, int);
+
+	int handle(int, int);
+
+	int handle_io(int, int);
+
+	int advance(int, bool, bool);
+
+	int complete(const reactor::event &);
+
+	int submit(int);
+
+	void check_timeouts();
+
+	void adapt_rate();
+
+	void publish_live();
 
-	btc_node *connect(const std::string &ip, uint16_t port);
+	btc_node *connect(uint32_t, const node_addr &);
 
-	btc_node *connect(const std::string &node);
+	int restore_text(const std::string &);
+
+	int restore_nodemap(const std::string &);
 
 public:
 
-	btc_scan()
+	btc_scan(node_db *db, unsigned shard = 0)
+		: m_db(db), m_shard(shard)
 	{
-		m_reconnects = numbers::btc_reconnects;
 	}
 
 	virtual ~btc_scan()
@@ -250,7 +391,7 @@ public:
 		freeaddrinfo(m_baddr6);
 
 		delete [] m_nodes;
-		delete [] m_pfds;
+		delete m_reactor;
 	}
 
 	const char *why()
@@ -258,7 +399,7 @@ public:
 		return m_err.c_str();
 	}
 
-	int init(const std::string &, const std::string &, const std::string &, const std::string &);
+	int init(const std::string &, const std::string &, const std::string &, const std::string &, const std::string &);
 
 	int loop();
 
@@ -269,28 +410,13 @@ public:
 
 	int restore_nodes(const std::string &);
 
-	bool learned_node(const std::string &s)
+	// only learn if not handled; true if it was new
+	bool learn_node(const node_addr &n, uint32_t time, uint64_t services)
 	{
-		return m_learned_nodes.count(s) > 0;
+		return m_db->learn(n, time, services);
 	}
 
-	void learn_node(const std::string &s)
-	{
-		// only learn if not handled
-		if (m_handled_nodes.count(s) == 0)
-			m_learned_nodes.emplace(s, 1);
-	}
-
-	void seed_nodes(const std::map<std::string, int> &seeds)
-	{
-		for (const auto &it : seeds)
-			learn_node(it.first);
-	}
-
-	bool handled_node(const std::string &s)
-	{
-		return m_handled_nodes.count(s) > 0;
-	}
+	int seed_nodes(const std::map<std::string, int> &);
 };
 
 
@@ -0,0 +1,101 @@
+/*
+ * This file is part of the hoschi p2p scan engine.
+ *
+ * (C) 2019 by Sebastian Krahmer,
+ *             sebastian [dot] krahmer [at] gmail [dot] com
+ *
+ * hoschi is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * hoschi is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with hoschi. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <new>
+#include <cstring>
+#include "buffer.h"
+
+
+using namespace std;
+
+
+namespace hoschi {
+
+
+char *rx_buffer::space(size_t n)
+{
+	if (m_cap - m_tail >= n)
+		return m_buf + m_tail;
+
+	size_t used = m_tail - m_head;
+
+	// enough room if we move the rest to the front?
+	if (m_cap - used >= n) {
+		memmove(m_buf, m_buf + m_head, used);
+		m_head = 0;
+		m_tail = used;
+		return m_buf + m_tail;
+	}
+
+	size_t cap = m_cap ? m_cap : n;
+	while (cap - used < n)
+		cap *= 2;
+
+	char *buf = new (nothrow) char[cap];
+	if (!buf)
+		return nullptr;
+	if (used)
+		memcpy(buf, m_buf + m_head, used);
+	delete [] m_buf;
+
+	m_buf = buf;
+	m_cap = cap;
+	m_head = 0;
+	m_tail = used;
+	return m_buf + m_tail;
+}
+
+
+int tx_queue::iov(struct iovec *v, int n)
+{
+	int i = 0;
+	size_t off = m_off;
+
+	for (auto it = m_msgs.begin(); it != m_msgs.end() && i < n; ++it, ++i) {
+		v[i].iov_base = const_cast<char *>(it->c_str() + off);
+		v[i].iov_len = it->size() - off;
+		off = 0;
+	}
+
+	return i;
+}
+
+
+void tx_queue::consume(size_t n)
+{
+	if (n > m_bytes)
+		n = m_bytes;
+	m_bytes -= n;
+
+	while (n > 0 && !m_msgs.empty()) {
+		size_t left = m_msgs.front().size() - m_off;
+		if (n < left) {
+			m_off += n;
+			return;
+		}
+		n -= left;
+		m_off = 0;
+		m_msgs.pop_front();
+	}
+}
+
+
+}
+
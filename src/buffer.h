@@ -0,0 +1,161 @@
+/*
+ * This file is part of the hoschi p2p scan engine.
+ *
+ * (C) 2019 by Sebastian Krahmer,
+ *             sebastian [dot] krahmer [at] gmail [dot] com
+ *
+ * hoschi is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * hoschi is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with hoschi. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef hoschi_buffer_h
+#define hoschi_buffer_h
+
+#include <cstddef>
+#include <deque>
+#include <string>
+#include <sys/uio.h>
+
+
+namespace hoschi {
+
+
+// Receive buffer of a node that is kept across reads. Data is appended at
+// the tail and consumed from the head. Consumed space is only reclaimed by
+// moving the unconsumed rest to the front once the tail runs out of room,
+// and the buffer only grows if a single message doesn't fit.
+class rx_buffer {
+
+	char *m_buf{nullptr};
+
+	size_t m_cap{0}, m_head{0}, m_tail{0};
+
+public:
+
+	rx_buffer()
+	{
+	}
+
+	virtual ~rx_buffer()
+	{
+		delete [] m_buf;
+	}
+
+	rx_buffer(const rx_buffer &) = delete;
+
+	rx_buffer &operator=(const rx_buffer &) = delete;
+
+	// make sure there are at least n bytes free at the tail; nullptr on OOM
+	char *space(size_t);
+
+	// free bytes at the tail
+	size_t room()
+	{
+		return m_cap - m_tail;
+	}
+
+	// n bytes were written to space()
+	void commit(size_t n)
+	{
+		m_tail += n;
+	}
+
+	const char *data()
+	{
+		return m_buf + m_head;
+	}
+
+	size_t size()
+	{
+		return m_tail - m_head;
+	}
+
+	void consume(size_t n)
+	{
+		m_head += n;
+		if (m_head >= m_tail)
+			m_head = m_tail = 0;
+	}
+
+	void clear()
+	{
+		m_head = m_tail = 0;
+	}
+
+	// empty the buffer, and give its memory back if it grew larger than max
+	void trim(size_t max)
+	{
+		clear();
+		if (m_cap > max) {
+			delete [] m_buf;
+			m_buf = nullptr;
+			m_cap = 0;
+		}
+	}
+};
+
+
+// Outgoing msgs of a node. Msgs are queued as they are and sent with writev(),
+// partial writes just advance the offset into the first msg.
+class tx_queue {
+
+	std::deque<std::string> m_msgs;
+
+	size_t m_off{0}, m_bytes{0};
+
+public:
+
+	tx_queue()
+	{
+	}
+
+	virtual ~tx_queue()
+	{
+	}
+
+	void push(std::string &&m)
+	{
+		if (m.size() == 0)
+			return;
+		m_bytes += m.size();
+		m_msgs.push_back(std::move(m));
+	}
+
+	bool empty()
+	{
+		return m_bytes == 0;
+	}
+
+	size_t size()
+	{
+		return m_bytes;
+	}
+
+	// fill at most n iovecs with pending data, returns number of iovecs used
+	int iov(struct iovec *, int);
+
+	// n bytes were sent
+	void consume(size_t);
+
+	void clear()
+	{
+		m_msgs.clear();
+		m_off = m_bytes = 0;
+	}
+};
+
+
+}
+
+#endif
+
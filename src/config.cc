@@ -19,6 +19,8 @@
  */
 
 #include <string>
+#include <cstdint>
+#include "misc.h"
 
 using namespace std;
 
@@ -29,10 +31,48 @@ namespace config {
 
 string log_file = "btclog.txt";
 
+bool async_log = 1;
+
+string log_levels = "info";
+
 string dump_file = "nodemap.txt";
 
 string restore_file = "";
 
+string convert_file = "";
+
+string engine = "epoll";
+
+unsigned int threads = 1;
+
+uint32_t connect_timeout = timeouts::connect;
+
+// about one connect per 15ms, as cable modems don't like it faster
+double connect_rate = 66, connect_burst = 4;
+
+// AIMD adaption of rate and number of nodes in flight, within these bounds
+bool adaptive = 0;
+
+double min_rate = 10, max_rate = 1000;
+
+uint32_t min_conns = 256, max_conns = 60000;
+
+// check payload checksums of received msgs
+bool verify_checksum = 0;
+
+// also learn loopback and private addresses, for scans of simulated networks
+bool allow_private = 0;
+
+// order in which learned nodes are connected
+string frontier = "fifo";
+
+// fsync the dump file: -1 never, 0 after every write, n every n seconds
+int fsync_interval = -1;
+
+string metrics_addr = "";
+
+int stats_interval = 60;
+
 }
 
 }
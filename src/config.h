@@ -22,6 +22,7 @@
 #define hoschi_config_h
 
 #include <string>
+#include <cstdint>
 
 namespace hoschi {
 
@@ -30,10 +31,42 @@ namespace config {
 
 extern std::string log_file;
 
+extern bool async_log;
+
+extern std::string log_levels;
+
 extern std::string dump_file;
 
 extern std::string restore_file;
 
+extern std::string convert_file;
+
+extern std::string engine;
+
+extern unsigned int threads;
+
+extern uint32_t connect_timeout;
+
+extern double connect_rate, connect_burst;
+
+extern bool adaptive;
+
+extern double min_rate, max_rate;
+
+extern uint32_t min_conns, max_conns;
+
+extern bool verify_checksum;
+
+extern bool allow_private;
+
+extern std::string frontier;
+
+extern int fsync_interval;
+
+extern std::string metrics_addr;
+
+extern int stats_interval;
+
 }
 
 }
@@ -18,7 +18,6 @@
  * along with hoschi. If not, see <http://www.gnu.org/licenses/>.
  */
 
-#include <map>
 #include <string>
 #include <cstdio>
 #include "btc-map.h"
@@ -36,9 +35,9 @@ namespace hoschi {
 
 
 
-int addr_filter::collect(uint32_t version, const string &node, const string &cmd, const string &data)
+int addr_filter::collect(uint32_t version, const string &node, const string &cmd, const char *data, size_t len)
 {
-	global::logger.logit("addr_filter:", node + " " + cmd);
+	LOG_DEBUG(logtag::filter, node + " " + cmd);
 
 	if (cmd != "addr")
 		return 0;
@@ -47,45 +46,47 @@ int addr_filter::collect(uint32_t version, const string &node, const string &cmd
 	if (version < 31402)
 		nsize = sizeof(net_addr_version);	// missing the time field
 
-	if (data.size() < sizeof(btc_header::header) + nsize + 1)
+	if (len < sizeof(btc_header::header) + nsize + 1)
 		return -1;
 
-	const char *payload = data.c_str() + sizeof(btc_header::header);
+	const char *payload = data + sizeof(btc_header::header);
 
 	uint8_t intsize = 0;
-	uint32_t naddrs = get_valint(payload, data.size() - sizeof(btc_header::header), intsize);
+	uint32_t naddrs = get_valint(payload, len - sizeof(btc_header::header), intsize);
 
 	// parse error for valint?
 	if (!intsize || naddrs > numbers::max_paylen)
 		return -1;
 
 	// can't wrap b/c of check above
-	if (naddrs*nsize + sizeof(btc_header::header) + intsize > data.size())
+	if (naddrs*nsize + sizeof(btc_header::header) + intsize > len)
 		return -1;
 
-	int family = 0;
+	node_addr lnode;
 	for (unsigned int i = 0; i < naddrs; ++i) {
-		string na = string(payload + intsize + i*nsize, nsize), lnode = "";
-		if (nsize == sizeof(net_addr))
-			family = parse_netaddr(na, lnode);
-		else
-			family = parse_netaddr_version(na, lnode);
+		const char *rec = payload + intsize + i*nsize;
+		uint32_t t = 0;
 
-		// family may be -1 for private IP address space. Only learn node if not already handled.
+		// skip the time field, if any
+		if (nsize == sizeof(net_addr)) {
+			t = btctoh32(reinterpret_cast<const net_addr *>(rec)->time);
+			rec += sizeof(net_addr) - sizeof(net_addr_version);
+		}
+
+		const auto *na = reinterpret_cast<const net_addr_version *>(rec);
+
+		// -1 for private IP address space. Only learn node if not already handled.
 		// Otherwise we may add nodes that are already in STATE_CONNECTING, causing double-connects
 		// and/or errors for port-reuse.
-		if (family >= 0) {
-			if (!m_parent_node->engine()->handled_node(lnode) && !m_parent_node->engine()->learned_node(lnode)) {
-				global::logger.logit("addr_filter:", "learned node " + lnode + " from " + node);
-				m_parent_node->engine()->learn_node(lnode);
-			}
-
-			auto it = m_addrs.find(node);
-			if (it != m_addrs.end()) {
-				if (it->second.find(lnode) == string::npos)
-					it->second += "," + lnode;
+		if (parse_netaddr(na, lnode) >= 0) {
+			global::stats.inc(metric::addrs);
+			if (m_parent_node->engine()->learn_node(lnode, t, btctoh64(na->services))) {
+				global::stats.inc(metric::addrs_new);
+				LOG_DEBUG(logtag::filter, "learned node " + lnode.str() + " from " + node);
 			} else
-				m_addrs.emplace(node, lnode);
+				global::stats.inc(metric::addrs_dup);
+
+			m_addrs.insert(lnode, lnode.hash());
 		}
 	}
 
@@ -95,12 +96,18 @@ int addr_filter::collect(uint32_t version, const string &node, const string &cmd
 
 int addr_filter::dump()
 {
-	free_ptr<FILE> f(fopen(config::dump_file.c_str(), "a"), [](FILE *fp){fclose(fp);});
-	if (!f.get())
-		return -1;
-	for (const auto &it : m_addrs)
-		fprintf(f.get(), "%s,%s\n", it.first.c_str(), it.second.c_str());
+	if (m_addrs.size() == 0)
+		return 0;
+
+	string line = m_parent_node->node();
+	line.reserve(line.size() + m_addrs.size()*24);
+	for (uint32_t i = 0; i < m_addrs.size(); ++i) {
+		line += ",";
+		line += m_addrs.at(i).str();
+	}
+	line += "\n";
 
+	global::writer.push(move(line));
 	return 0;
 }
 
@@ -24,6 +24,7 @@
 #include <string>
 #include <iostream>
 #include "btc-map.h"
+#include "node-table.h"
 
 namespace hoschi {
 
@@ -45,9 +46,12 @@ public:
 	{
 	}
 
-	virtual int collect(uint32_t, const std::string&, const std::string&, const std::string &) = 0;
+	virtual int collect(uint32_t, const std::string&, const std::string&, const char *, size_t) = 0;
 
 	virtual	int dump() = 0;
+
+	// forget what was collected, so the filter can be re-used for another connect
+	virtual void clear() = 0;
 };
 
 
@@ -65,7 +69,7 @@ public:
 	{
 	}
 
-	int collect(uint32_t version, const std::string& node, const std::string &cmd, const std::string &data) override
+	int collect(uint32_t version, const std::string& node, const std::string &cmd, const char *data, size_t len) override
 	{
 		std::cerr<<version<<" "<<node<<" "<<cmd<<std::endl;
 		return 0;
@@ -75,12 +79,18 @@ public:
 	{
 		return 0;
 	}
+
+	void clear() override
+	{
+	}
 };
 
 
+// Collects the addrs a node told us about. They are kept binary and in the
+// order they were received, text is only made when dumping.
 class addr_filter : public filter {
 
-	std::map<std::string, std::string> m_addrs;
+	node_table m_addrs;
 
 public:
 
@@ -94,9 +104,14 @@ public:
 	{
 	}
 
-	int collect(uint32_t, const std::string &, const std::string &, const std::string &) override;
+	int collect(uint32_t, const std::string &, const std::string &, const char *, size_t) override;
 
 	int dump() override;
+
+	void clear() override
+	{
+		m_addrs.clear();
+	}
 };
 
 }	// namespace hoschi
@@ -0,0 +1,137 @@
+/*
+ * This file is part of the hoschi p2p scan engine.
+ *
+ * (C) 2019 by Sebastian Krahmer,
+ *             sebastian [dot] krahmer [at] gmail [dot] com
+ *
+ * hoschi is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * hoschi is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with hoschi. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <new>
+#include <string>
+#include <deque>
+#include <cstdint>
+#include "frontier.h"
+#include "protocol.h"
+
+
+using namespace std;
+
+
+namespace hoschi {
+
+
+bool fifo_frontier::pop(entry &e)
+{
+	if (m_q.empty())
+		return 0;
+	e = m_q.front();
+	m_q.pop_front();
+	return 1;
+}
+
+
+bool fresh_frontier::pop(entry &e)
+{
+	if (m_q.empty())
+		return 0;
+	e = m_q.top();
+	m_q.pop();
+	return 1;
+}
+
+
+void services_frontier::push(const entry &e)
+{
+	if (e.services & numbers::node_network)
+		m_full.push_back(e);
+	else
+		m_rest.push_back(e);
+}
+
+
+bool services_frontier::pop(entry &e)
+{
+	auto &q = m_full.empty() ? m_rest : m_full;
+
+	if (q.empty())
+		return 0;
+	e = q.front();
+	q.pop_front();
+	return 1;
+}
+
+
+void prefix_frontier::push(const entry &e)
+{
+	auto &q = m_nets[e.prefix];
+	if (q.empty())
+		m_ring.push_back(e.prefix);
+	q.push_back(e);
+	++m_size;
+}
+
+
+bool prefix_frontier::pop(entry &e)
+{
+	if (m_ring.empty())
+		return 0;
+
+	uint64_t prefix = m_ring.front();
+	m_ring.pop_front();
+
+	auto it = m_nets.find(prefix);
+	e = it->second.front();
+	it->second.pop_front();
+	--m_size;
+
+	// back to the end of the ring if it has more
+	if (it->second.empty())
+		m_nets.erase(it);
+	else
+		m_ring.push_back(prefix);
+
+	return 1;
+}
+
+
+size_t delay_queue::release(time_t now, frontier &f)
+{
+	size_t n = 0;
+
+	for (; !m_q.empty() && m_q.top().due <= now; ++n) {
+		f.push(m_q.top().e);
+		m_q.pop();
+	}
+
+	return n;
+}
+
+
+frontier *make_frontier(const string &name)
+{
+	if (name == "fifo")
+		return new (nothrow) fifo_frontier();
+	if (name == "fresh")
+		return new (nothrow) fresh_frontier();
+	if (name == "services")
+		return new (nothrow) services_frontier();
+	if (name == "prefix")
+		return new (nothrow) prefix_frontier();
+	return nullptr;
+}
+
+
+}
+
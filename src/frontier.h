@@ -0,0 +1,232 @@
+/*
+ * This file is part of the hoschi p2p scan engine.
+ *
+ * (C) 2019 by Sebastian Krahmer,
+ *             sebastian [dot] krahmer [at] gmail [dot] com
+ *
+ * hoschi is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * hoschi is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with hoschi. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef hoschi_frontier_h
+#define hoschi_frontier_h
+
+#include <string>
+#include <deque>
+#include <queue>
+#include <vector>
+#include <cstdint>
+#include <time.h>
+#include <unordered_map>
+
+
+namespace hoschi {
+
+
+// The order in which a shard connects to the nodes it learned. Each node
+// is in at most one frontier at a time.
+class frontier {
+
+public:
+
+	struct entry {
+		uint32_t id{0};
+		uint32_t time{0};	// as gossiped in net_addr, 0 if not known
+		uint64_t prefix{0};	// /16 of IPv4, /32 of IPv6 nodes, see node_addr::prefix()
+		uint8_t services{0};	// low bits of the advertised services
+	};
+
+	frontier()
+	{
+	}
+
+	virtual ~frontier()
+	{
+	}
+
+	virtual void push(const entry &) = 0;
+
+	// false if empty
+	virtual bool pop(entry &) = 0;
+
+	virtual size_t size() = 0;
+
+	virtual const char *name() = 0;
+};
+
+
+// in order of discovery
+class fifo_frontier : public frontier {
+
+	std::deque<entry> m_q;
+
+public:
+
+	void push(const entry &e) override
+	{
+		m_q.push_back(e);
+	}
+
+	bool pop(entry &) override;
+
+	size_t size() override
+	{
+		return m_q.size();
+	}
+
+	const char *name() override
+	{
+		return "fifo";
+	}
+};
+
+
+// most recently gossiped nodes first, as they are most likely still up
+class fresh_frontier : public frontier {
+
+	struct older {
+		bool operator()(const entry &a, const entry &b)
+		{
+			return a.time < b.time;
+		}
+	};
+
+	std::priority_queue<entry, std::vector<entry>, older> m_q;
+
+public:
+
+	void push(const entry &e) override
+	{
+		m_q.push(e);
+	}
+
+	bool pop(entry &) override;
+
+	size_t size() override
+	{
+		return m_q.size();
+	}
+
+	const char *name() override
+	{
+		return "fresh";
+	}
+};
+
+
+// nodes advertising NODE_NETWORK first, in order of discovery otherwise
+class services_frontier : public frontier {
+
+	std::deque<entry> m_full, m_rest;
+
+public:
+
+	void push(const entry &) override;
+
+	bool pop(entry &) override;
+
+	size_t size() override
+	{
+		return m_full.size() + m_rest.size();
+	}
+
+	const char *name() override
+	{
+		return "services";
+	}
+};
+
+
+// round robin across network prefixes, so connects are spread across
+// providers instead of hitting the same networks in bursts
+class prefix_frontier : public frontier {
+
+	std::unordered_map<uint64_t, std::deque<entry>> m_nets;
+
+	// prefixes that have nodes queued, in round robin order
+	std::deque<uint64_t> m_ring;
+
+	size_t m_size{0};
+
+public:
+
+	void push(const entry &) override;
+
+	bool pop(entry &) override;
+
+	size_t size() override
+	{
+		return m_size;
+	}
+
+	const char *name() override
+	{
+		return "prefix";
+	}
+};
+
+
+frontier *make_frontier(const std::string &);
+
+
+// Nodes that may not be connected again before a given time, as a fixed
+// source port may still be in TIME_WAIT towards them. Ordered by that time,
+// so only nodes that are due are ever looked at.
+class delay_queue {
+
+	struct delayed {
+		time_t due{0};
+		frontier::entry e;
+	};
+
+	struct later {
+		bool operator()(const delayed &a, const delayed &b)
+		{
+			return a.due > b.due;
+		}
+	};
+
+	std::priority_queue<delayed, std::vector<delayed>, later> m_q;
+
+public:
+
+	delay_queue()
+	{
+	}
+
+	virtual ~delay_queue()
+	{
+	}
+
+	void push(time_t due, const frontier::entry &e)
+	{
+		delayed d;
+		d.due = due;
+		d.e = e;
+		m_q.push(d);
+	}
+
+	// move all nodes that are due at 'now' into the frontier
+	size_t release(time_t, frontier &);
+
+	size_t size()
+	{
+		return m_q.size();
+	}
+};
+
+
+}
+
+#endif
+
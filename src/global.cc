@@ -22,6 +22,8 @@
 #include <time.h>
 #include <string>
 #include "log.h"
+#include "writer.h"
+#include "metrics.h"
 
 namespace hoschi {
 
@@ -31,6 +33,10 @@ namespace global {
 
 	log logger;
 
+	result_writer writer;
+
+	metrics stats;
+
 	string client_name{"/Satoshi:0.17.99/"};
 
 }
@@ -25,6 +25,8 @@
 #include <string>
 #include <time.h>
 #include "log.h"
+#include "writer.h"
+#include "metrics.h"
 
 namespace hoschi {
 
@@ -32,11 +34,49 @@ namespace global {
 
 extern log logger;
 
+extern result_writer writer;
+
+extern metrics stats;
+
 extern std::string client_name;
 
 }
 
 }
 
+
+// The msg is only built if the line is logged at all. Lines below HOSCHI_LOG_MIN
+// are compiled out, as the condition is constant then.
+#define LOG(tag, level, msg) \
+	do { \
+		if ((level) >= HOSCHI_LOG_MIN && hoschi::global::logger.enabled(tag, level)) \
+			hoschi::global::logger.logit(tag, level, msg); \
+	} while (0)
+
+// Same, with time t instead of now
+#define LOG_AT(tag, level, msg, t) \
+	do { \
+		if ((level) >= HOSCHI_LOG_MIN && hoschi::global::logger.enabled(tag, level)) \
+			hoschi::global::logger.logit(tag, level, msg, t); \
+	} while (0)
+
+// For lines that repeat a lot, like poll errors: at most numbers::log_burst per second from
+// this call site, the next one that passes tells how many were held back.
+#define LOG_LIMITED(tag, level, msg) \
+	do { \
+		if ((level) >= HOSCHI_LOG_MIN && hoschi::global::logger.enabled(tag, level)) { \
+			static hoschi::log_limit limit_; \
+			uint32_t suppressed_ = 0; \
+			if (limit_.pass(time(nullptr), suppressed_)) \
+				hoschi::global::logger.logit(tag, level, suppressed_ == 0 ? std::string(msg) : \
+				    std::string(msg) + " (" + std::to_string(suppressed_) + " similar lines suppressed)"); \
+		} \
+	} while (0)
+
+#define LOG_DEBUG(tag, msg)	LOG(tag, hoschi::loglevel::debug, msg)
+#define LOG_INFO(tag, msg)	LOG(tag, hoschi::loglevel::info, msg)
+#define LOG_WARN(tag, msg)	LOG(tag, hoschi::loglevel::warn, msg)
+#define LOG_ERROR(tag, msg)	LOG(tag, hoschi::loglevel::error, msg)
+
 #endif
 
@@ -0,0 +1,127 @@
+/*
+ * This file is part of the hoschi p2p scan engine.
+ *
+ * (C) 2019 by Sebastian Krahmer,
+ *             sebastian [dot] krahmer [at] gmail [dot] com
+ *
+ * hoschi is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * hoschi is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with hoschi. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string>
+#include <atomic>
+#include <cstdint>
+#include "histogram.h"
+
+
+using namespace std;
+
+
+namespace hoschi {
+
+
+histogram::histogram()
+{
+	for (int i = 0; i < buckets; ++i)
+		m_counts[i].store(0, memory_order_relaxed);
+}
+
+
+int histogram::bucket_of(uint64_t v)
+{
+	if (v < uint64_t(sub_count))
+		return v;
+
+	// the power of two that v falls into, and the sub bucket within it
+	int e = 63 - __builtin_clzll(v);
+	return (e - sub_bits)*sub_count + (v>>(e - sub_bits));
+}
+
+
+uint64_t histogram::upper_of(int b)
+{
+	if (b < 2*sub_count)
+		return b;
+
+	int e = b/sub_count + sub_bits - 1;
+	uint64_t width = uint64_t(1)<<(e - sub_bits);
+	uint64_t low = uint64_t(b%sub_count + sub_count)<<(e - sub_bits);
+	return low + width - 1;
+}
+
+
+void histogram::record(uint64_t v)
+{
+	m_counts[bucket_of(v)].fetch_add(1, memory_order_relaxed);
+	m_count.fetch_add(1, memory_order_relaxed);
+	m_sum.fetch_add(v, memory_order_relaxed);
+
+	uint64_t max = m_max.load(memory_order_relaxed);
+	while (v > max && !m_max.compare_exchange_weak(max, v, memory_order_relaxed));
+}
+
+
+uint64_t histogram::percentile(double p)
+{
+	uint64_t n = count();
+	if (n == 0)
+		return 0;
+
+	uint64_t want = uint64_t(p*n + 0.5), seen = 0;
+	if (want == 0)
+		want = 1;
+
+	for (int i = 0; i < buckets; ++i) {
+		seen += m_counts[i].load(memory_order_relaxed);
+		if (seen >= want)
+			return upper_of(i) < max() ? upper_of(i) : max();
+	}
+
+	return max();
+}
+
+
+uint64_t histogram::count_upto(uint64_t v)
+{
+	uint64_t n = 0;
+
+	for (int i = 0; i <= bucket_of(v); ++i) {
+		if (upper_of(i) > v)
+			break;
+		n += m_counts[i].load(memory_order_relaxed);
+	}
+
+	return n;
+}
+
+
+string histogram::summary()
+{
+	string s = "n=" + to_string(count());
+
+	if (count() > 0) {
+		s += " min=" + to_string(percentile(0));
+		s += " p50=" + to_string(percentile(0.5));
+		s += " p90=" + to_string(percentile(0.9));
+		s += " p99=" + to_string(percentile(0.99));
+		s += " p99.9=" + to_string(percentile(0.999));
+		s += " max=" + to_string(max());
+		s += " mean=" + to_string(sum()/count());
+	}
+
+	return s;
+}
+
+
+}
+
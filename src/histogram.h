@@ -0,0 +1,97 @@
+/*
+ * This file is part of the hoschi p2p scan engine.
+ *
+ * (C) 2019 by Sebastian Krahmer,
+ *             sebastian [dot] krahmer [at] gmail [dot] com
+ *
+ * hoschi is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * hoschi is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with hoschi. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef hoschi_histogram_h
+#define hoschi_histogram_h
+
+#include <string>
+#include <atomic>
+#include <cstdint>
+#include "misc.h"
+
+
+namespace hoschi {
+
+
+// HDR style histogram of non-negative integers. Values below 2^sub_bits have
+// a bucket each, above that every power of two is split into 2^sub_bits
+// buckets, so a value is off by less than 1/2^sub_bits wherever it falls.
+// Recording is a relaxed atomic increment, readers see a consistent enough view.
+class histogram {
+
+	enum : int {
+		sub_bits	= numbers::hist_sub_bits,
+		sub_count	= 1<<sub_bits,
+		buckets		= (64 - sub_bits + 1)*sub_count
+	};
+
+	std::atomic<uint64_t> m_counts[buckets];
+
+	std::atomic<uint64_t> m_count{0}, m_sum{0}, m_max{0};
+
+	static int bucket_of(uint64_t);
+
+	// largest value that falls into bucket
+	static uint64_t upper_of(int);
+
+public:
+
+	histogram();
+
+	virtual ~histogram()
+	{
+	}
+
+	histogram(const histogram &) = delete;
+
+	histogram &operator=(const histogram &) = delete;
+
+	void record(uint64_t);
+
+	uint64_t count()
+	{
+		return m_count.load(std::memory_order_relaxed);
+	}
+
+	uint64_t sum()
+	{
+		return m_sum.load(std::memory_order_relaxed);
+	}
+
+	uint64_t max()
+	{
+		return m_max.load(std::memory_order_relaxed);
+	}
+
+	// value below which the given fraction of recorded values is; 0 if empty
+	uint64_t percentile(double);
+
+	// number of values <= v, exact if v + 1 is a power of two
+	uint64_t count_upto(uint64_t);
+
+	// "n=.. min=.. p50=.. p90=.. p99=.. p99.9=.. max=.."
+	std::string summary();
+};
+
+
+}
+
+#endif
+
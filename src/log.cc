@@ -18,57 +18,265 @@
  * along with hoschi. If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <new>
 #include <cstdio>
+#include <cctype>
 #include <cstring>
 #include <string>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <chrono>
 #include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include "log.h"
+#include "misc.h"
 
 using namespace std;
 
 namespace hoschi {
 
 
-int log::init(const string &path)
+static const char *level_names[] = {"debug", "info", "warn", "error", "none"};
+
+static const char *tag_names[] = {"main", "btcmap", "addr_filter", "restore", "writer", "log", "stats"};
+
+
+static int find_name(const char **names, int n, const string &name)
 {
-	if (!(f = fopen(path.c_str(), "a")))
+	for (int i = 0; i < n; ++i) {
+		if (name == names[i])
+			return i;
+	}
+	return -1;
+}
+
+
+bool log_limit::pass(time_t t, uint32_t &suppressed)
+{
+	time_t w = m_window.load(memory_order_relaxed);
+	if (t != w && m_window.compare_exchange_strong(w, t, memory_order_relaxed))
+		m_count.store(0, memory_order_relaxed);
+
+	if (m_count.fetch_add(1, memory_order_relaxed) < numbers::log_burst) {
+		suppressed = m_suppressed.exchange(0, memory_order_relaxed);
+		return 1;
+	}
+
+	m_suppressed.fetch_add(1, memory_order_relaxed);
+	return 0;
+}
+
+
+log::~log()
+{
+	stop();
+	if (m_fd >= 0)
+		close(m_fd);
+}
+
+
+int log::init(const string &path, bool async)
+{
+	if ((m_fd = open(path.c_str(), O_WRONLY|O_CREAT|O_APPEND|O_CLOEXEC, 0644)) < 0)
 		return -1;
 
+	if (!async)
+		return 0;
+
+	// without the ring, just log synchronously
+	m_ring.reset(new (nothrow) slot[numbers::log_ring]);
+	if (!m_ring.get())
+		return 0;
+	for (uint64_t i = 0; i < numbers::log_ring; ++i)
+		m_ring[i].seq.store(i, memory_order_relaxed);
+
+	m_batch.reserve(numbers::max_write_batch);
+	m_async = 1;
+	m_thread = thread(&log::run, this);
 	return 0;
 }
 
 
 extern "C" struct tm *localtime_r(const time_t *, struct tm *);
 
-int log::logit(const string &tag, const string &s, time_t t)
+int log::levels(const string &spec)
 {
-	if (!f)
-		return -1;
+	string::size_type start = 0, comma = 0;
 
-	if (!t)
-		t = time(nullptr);
-	struct tm tm;
-	memset(&tm, 0, sizeof(tm));
-
-	localtime_r(&t, &tm);
-	char local_date[64] = {0};
-	strftime(local_date, sizeof(local_date) - 1, "%a, %d %b %Y %H:%M:%S", &tm);
-
-	string msg = s;
-	string::size_type nl = 0;
-	if (msg.size() > 1 && (nl = msg.find_last_of("\n")) == msg.size() - 1)
-		msg.erase(nl, 1);
-	for (string::size_type i = 0; i < msg.size(); ++i) {
-		if (!isprint(msg[i]))
-			msg[i] = '?';
+	for (; start <= spec.size(); start = comma + 1) {
+		if ((comma = spec.find(",", start)) == string::npos)
+			comma = spec.size();
+		string item = spec.substr(start, comma - start);
+		string::size_type eq = item.find("=");
+
+		int level = find_name(level_names, loglevel::none + 1, eq == string::npos ? item : item.substr(eq + 1));
+		if (level < 0)
+			return -1;
+
+		if (eq == string::npos) {
+			for (int i = 0; i < logtag::max; ++i)
+				m_level[i] = level;
+		} else {
+			int tag = find_name(tag_names, logtag::max, item.substr(0, eq));
+			if (tag < 0)
+				return -1;
+			m_level[tag] = level;
+		}
 	}
 
-	fprintf(f, "%s: %s %s\n", local_date, tag.c_str(), msg.c_str());
-	fflush(f);
 	return 0;
 }
 
 
+// append a line to the batch
+void log::format(time_t t, int tag, int level, const char *msg, size_t mlen)
+{
+	if (t != m_cached_t) {
+		struct tm tm;
+		memset(&tm, 0, sizeof(tm));
+		localtime_r(&t, &tm);
+		strftime(m_cached_date, sizeof(m_cached_date) - 1, "%a, %d %b %Y %H:%M:%S", &tm);
+		m_cached_t = t;
+	}
+
+	if (mlen > 1 && msg[mlen - 1] == '\n')
+		--mlen;
+
+	m_batch += m_cached_date;
+	m_batch += ": ";
+	m_batch += level_names[level];
+	m_batch += " ";
+	m_batch += tag_names[tag];
+	m_batch += ": ";
+
+	string::size_type start = m_batch.size();
+	m_batch.append(msg, mlen);
+	for (string::size_type i = start; i < m_batch.size(); ++i) {
+		if (!isprint(m_batch[i]))
+			m_batch[i] = '?';
+	}
+	m_batch += "\n";
+}
+
+
+bool log::enqueue(time_t t, int tag, int level, const string &msg)
+{
+	uint64_t pos = m_enq.load(memory_order_relaxed);
+	slot *s = nullptr;
+
+	for (;;) {
+		s = &m_ring[pos & (numbers::log_ring - 1)];
+		int64_t d = int64_t(s->seq.load(memory_order_acquire)) - int64_t(pos);
+		if (d == 0) {
+			if (m_enq.compare_exchange_weak(pos, pos + 1, memory_order_relaxed))
+				break;
+		} else if (d < 0) {
+			// full, the drain thread is behind
+			m_dropped.fetch_add(1, memory_order_relaxed);
+			return 0;
+		} else
+			pos = m_enq.load(memory_order_relaxed);
+	}
+
+	// long lines are cut
+	size_t len = msg.size() < sizeof(s->text) ? msg.size() : sizeof(s->text);
+
+	s->t = t;
+	s->tag = tag;
+	s->level = level;
+	s->len = len;
+	memcpy(s->text, msg.c_str(), len);
+
+	s->seq.store(pos + 1, memory_order_release);
+	return 1;
+}
+
+
+// only called by the drain thread
+bool log::drain()
+{
+	for (;;) {
+		slot &s = m_ring[m_deq & (numbers::log_ring - 1)];
+		if (s.seq.load(memory_order_acquire) != m_deq + 1)
+			break;
+
+		format(s.t, s.tag, s.level, s.text, s.len);
+
+		s.seq.store(m_deq + numbers::log_ring, memory_order_release);
+		++m_deq;
+
+		if (m_batch.size() >= numbers::max_write_batch)
+			break;
+	}
+
+	uint64_t dropped = m_dropped.load(memory_order_relaxed);
+	if (dropped != m_reported) {
+		string msg = "Dropped " + to_string(dropped - m_reported) + " log lines, as the log ring was full.";
+		format(time(nullptr), logtag::log, loglevel::warn, msg.c_str(), msg.size());
+		m_reported = dropped;
+	}
+
+	if (m_batch.empty())
+		return 0;
+
+	for (size_t off = 0; off < m_batch.size();) {
+		ssize_t r = write(m_fd, m_batch.c_str() + off, m_batch.size() - off);
+		if (r <= 0)
+			break;
+		off += r;
+	}
+
+	m_batch.clear();
+	return 1;
+}
+
+
+void log::run()
+{
+	while (!m_stop.load(memory_order_acquire)) {
+		if (!drain())
+			this_thread::sleep_for(chrono::milliseconds(timeouts::log_idle));
+	}
+}
+
+
+void log::stop()
+{
+	if (!m_thread.joinable())
+		return;
+
+	// everyone logging from now on does it himself
+	m_async = 0;
+
+	m_stop.store(1, memory_order_release);
+	m_thread.join();
+
+	while (drain());
+}
+
+
+int log::logit(int tag, int level, const string &s, time_t t)
+{
+	if (m_fd < 0 || tag < 0 || tag >= logtag::max || level < 0 || level >= loglevel::none)
+		return -1;
+
+	if (!t)
+		t = time(nullptr);
+
+	if (m_async)
+		return enqueue(t, tag, level, s) ? 0 : -1;
+
+	lock_guard<mutex> g(m_lock);
+	format(t, tag, level, s.c_str(), s.size());
+	if (write(m_fd, m_batch.c_str(), m_batch.size()) < 0) {
+		m_batch.clear();
+		return -1;
+	}
+	m_batch.clear();
+	return 0;
+}
 
 
 } // namespace hoschi
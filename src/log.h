@@ -22,30 +22,157 @@
 #define hoschi_log_h
 
 #include <string>
-#include <cstdio>
+#include <atomic>
+#include <thread>
+#include <memory>
+#include <mutex>
+#include <cstdint>
+#include <time.h>
+#include "misc.h"
+
+// Lines below this level are compiled out by the LOG macros in global.h.
+// Build with DEFS=-DHOSCHI_LOG_MIN=1 to get rid of all debug logging.
+#ifndef HOSCHI_LOG_MIN
+#define HOSCHI_LOG_MIN 0
+#endif
 
 namespace hoschi {
 
+
+namespace loglevel {
+
+enum : int {
+	debug	= 0,
+	info	= 1,
+	warn	= 2,
+	error	= 3,
+	none	= 4
+};
+
+}
+
+
+// subsystems that log, each with a level of its own
+namespace logtag {
+
+enum : int {
+	main	= 0,
+	scan,
+	filter,
+	restore,
+	writer,
+	log,
+	stats,
+	max
+};
+
+}
+
+
+// Lets a call site log at most numbers::log_burst lines per second, and
+// counts what it held back.
+class log_limit {
+
+	std::atomic<time_t> m_window{0};
+
+	std::atomic<uint32_t> m_count{0}, m_suppressed{0};
+
+public:
+
+	log_limit()
+	{
+	}
+
+	virtual ~log_limit()
+	{
+	}
+
+	// whether a line may be logged at t; if so, how many were held back before it
+	bool pass(time_t, uint32_t &);
+};
+
+
 class log {
 
-	std::FILE *f{nullptr};
+	// A queued line. Text is copied in as it is and made printable by the
+	// drain thread, so the callers only pay for the copy.
+	struct slot {
+		std::atomic<uint64_t> seq{0};
+		time_t t{0};
+		int8_t tag{0}, level{0};
+		uint16_t len{0};
+		char text[numbers::log_slot];
+	};
+
+	int m_fd{-1};
+
+	// set before the shards run, only read afterwards
+	int m_level[logtag::max];
+
+	std::atomic<bool> m_async{0};
+
+	// only for the synchronous mode
+	std::mutex m_lock;
+
+	// Vyukov's bounded MPMC queue, used with a single consumer
+	std::unique_ptr<slot[]> m_ring;
+	std::atomic<uint64_t> m_enq{0};
+	uint64_t m_deq{0};
+
+	std::atomic<bool> m_stop{0};
+
+	std::thread m_thread;
+
+	std::atomic<uint64_t> m_dropped{0};
+	uint64_t m_reported{0};
+
+	// the formatted date of the second we last saw
+	time_t m_cached_t{0};
+	char m_cached_date[64]{0};
+
+	std::string m_batch{""};
+
+	void format(time_t, int, int, const char *, size_t);
+
+	bool enqueue(time_t, int, int, const std::string &);
+
+	// format all queued lines into the batch and write it; true if anything was written
+	bool drain();
+
+	void run();
 
 public:
 
 	log()
 	{
+		for (int i = 0; i < logtag::max; ++i)
+			m_level[i] = loglevel::info;
 	}
 
-	virtual ~log()
+	virtual ~log();
+
+	// open log file, and start the drain thread if async
+	int init(const std::string &, bool async = 0);
+
+	// "level[,tag=level]...", e.g. "warn,addr_filter=debug"; -1 if invalid
+	int levels(const std::string &);
+
+	bool enabled(int tag, int level)
 	{
-		if (f)
-			std::fclose(f);
+		return level >= m_level[tag];
 	}
 
-	int init(const std::string &);
+	// use the LOG macros, which check enabled() before building the msg
+	int logit(int, int, const std::string &, time_t t = 0);
 
-	int logit(const std::string &, const std::string &, time_t t = 0);
+	// write what is still queued and stop the drain thread
+	void stop();
 
+	// lines lost because the ring was full
+	uint64_t dropped()
+	{
+		return m_dropped;
+	}
 };
 
 
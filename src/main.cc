@@ -19,7 +19,11 @@
  */
 
 #include <map>
+#include <vector>
+#include <memory>
+#include <thread>
 #include <string>
+#include <cstdio>
 #include <cstring>
 #include <cstdlib>
 #include <signal.h>
@@ -27,6 +31,7 @@
 #include "config.h"
 #include "global.h"
 #include "btc-map.h"
+#include "nodemap.h"
 
 
 using namespace std;
@@ -35,19 +40,60 @@ using namespace hoschi;
 
 void usage()
 {
-	cout<<"Usage:\n\nhoschi <-4 ip4> <-6 ip6> [-p lport] [-r node-file] [-d node-file] [-l logfile] <-s seed-node> [-s seednode] ...\n"
+	cout<<"Usage:\n\nhoschi <-4 ip4> <-6 ip6> [-p lport] [-r node-file] [-d node-file] [-l logfile] [-L mode] [-v levels] [-E engine] [-T threads] [-c msec] [-R rate] [-B burst] [-A min:max] [-N min:max] [-V] [-U] [-F policy] [-Y fsync] [-M [ip]:port] [-I sec] [-C node-file] <-s seed-node> [-s seednode] ...\n"
 	    <<"\t-4 -- local IPv4 address to bind to\n"
 	    <<"\t-6 -- local IPv6 address to bind to\n"
 	    <<"\t-p -- local port to bind to (default any)\n"
 	    <<"\t-r -- restore from previous mapping's result dumped into '-d'\n"
 	    <<"\t-d -- dump (append) found nodes to this file; default: nodemap.txt\n"
 	    <<"\t-l -- log what we do to this file; default: btclog.txt\n"
+	    <<"\t-L -- log mode: async (from a thread of its own, drops lines when falling behind) or sync; default: async\n"
+	    <<"\t-v -- log level: debug, info, warn, error or none, optionally followed by levels for some of\n"
+	    <<"\t      main, btcmap, addr_filter, restore, writer, stats, e.g. 'warn,btcmap=debug'; default: info\n"
+	    <<"\t-E -- I/O engine to use: poll, epoll or io_uring; default: epoll\n"
+	    <<"\t-T -- number of scan engine threads; default: 1\n"
+	    <<"\t-c -- connect timeout in milliseconds; default: 30000\n"
+	    <<"\t-R -- max connects per second, 0 for no limit; default: 66\n"
+	    <<"\t-B -- max burst of connects above that rate, split across threads but at least 1 each; default: 4\n"
+	    <<"\t-A -- adapt connect rate to uplink losses, within min:max connects per second\n"
+	    <<"\t-N -- when adapting, keep between min:max nodes in flight; default: 256:60000\n"
+	    <<"\t-V -- verify checksums of received messages and drop nodes sending bad ones\n"
+	    <<"\t-U -- also connect to loopback and private addresses, e.g. to scan a simulated network\n"
+	    <<"\t-F -- order of connects: fifo, fresh (recently gossiped first), services (full nodes first)\n"
+	    <<"\t      or prefix (round robin across /16 and /32 networks); default: fifo\n"
+	    <<"\t-Y -- fsync the dump file: never, batch (after every write) or every n seconds; default: never\n"
+	    <<"\t-M -- serve metrics in Prometheus text format at http://[ip]:port/metrics\n"
+	    <<"\t-I -- log a stats line every that many seconds, 0 to disable; default: 60\n"
+	    <<"\t-C -- convert the '-r' file between text and binary nodemap format into this file and exit\n"
 	    <<"\t-s -- seed with this node. format is [ip]:port where ip is v4 or v6. [127.0.0.1]:8333 if you run a local bitcoind\n\n";
 
 	exit(1);
 }
 
 
+// text to binary or the other way round, depending on what 'in' is
+int convert(const string &in, const string &out)
+{
+	if (nodemap::probe(in)) {
+		nodemap nm;
+		if (nm.open(in) < 0 || nm.write_text(out) < 0) {
+			cerr<<"Error: "<<nm.why()<<endl;
+			return 1;
+		}
+		cout<<"Wrote "<<in<<" as text nodemap to "<<out<<".\n";
+		return 0;
+	}
+
+	nodemap_builder nb;
+	if (nb.read_text(in) < 0 || nb.write(out) < 0) {
+		cerr<<"Error: "<<nb.why()<<endl;
+		return 1;
+	}
+	cout<<"Wrote "<<in<<" as binary nodemap to "<<out<<".\n";
+	return 0;
+}
+
+
 int main(int argc, char **argv)
 {
 	int c = 0;
@@ -57,7 +103,7 @@ int main(int argc, char **argv)
 
 	cout<<"\nhoschi v0.1 (C) Sebastian Krahmer -- https://github.com/stealth/hoschi\n\n";
 
-	for (;(c = getopt(argc, argv, "r:d:s:4:6:p:")) != -1;) {
+	for (;(c = getopt(argc, argv, "r:d:l:L:v:s:4:6:p:E:T:c:R:B:A:N:VUF:Y:C:M:I:")) != -1;) {
 		switch (c) {
 		case 'r':
 			config::restore_file = optarg;
@@ -68,6 +114,17 @@ int main(int argc, char **argv)
 		case 'l':
 			config::log_file = optarg;
 			break;
+		case 'L':
+			if (strcmp(optarg, "async") == 0)
+				config::async_log = 1;
+			else if (strcmp(optarg, "sync") == 0)
+				config::async_log = 0;
+			else
+				usage();
+			break;
+		case 'v':
+			config::log_levels = optarg;
+			break;
 		case 's':
 			seeds.emplace(optarg, 1);
 			break;
@@ -80,6 +137,56 @@ int main(int argc, char **argv)
 		case 'p':
 			lport = optarg;
 			break;
+		case 'E':
+			config::engine = optarg;
+			break;
+		case 'T':
+			config::threads = strtoul(optarg, nullptr, 10);
+			break;
+		case 'c':
+			config::connect_timeout = strtoul(optarg, nullptr, 10);
+			break;
+		case 'R':
+			config::connect_rate = strtod(optarg, nullptr);
+			break;
+		case 'B':
+			config::connect_burst = strtod(optarg, nullptr);
+			break;
+		case 'A':
+			if (sscanf(optarg, "%lf:%lf", &config::min_rate, &config::max_rate) != 2)
+				usage();
+			config::adaptive = 1;
+			break;
+		case 'N':
+			if (sscanf(optarg, "%u:%u", &config::min_conns, &config::max_conns) != 2)
+				usage();
+			break;
+		case 'V':
+			config::verify_checksum = 1;
+			break;
+		case 'U':
+			config::allow_private = 1;
+			break;
+		case 'F':
+			config::frontier = optarg;
+			break;
+		case 'Y':
+			if (strcmp(optarg, "never") == 0)
+				config::fsync_interval = -1;
+			else if (strcmp(optarg, "batch") == 0)
+				config::fsync_interval = 0;
+			else if ((config::fsync_interval = atoi(optarg)) <= 0)
+				usage();
+			break;
+		case 'C':
+			config::convert_file = optarg;
+			break;
+		case 'M':
+			config::metrics_addr = optarg;
+			break;
+		case 'I':
+			config::stats_interval = atoi(optarg);
+			break;
 		default:
 			usage();
 		}
@@ -90,31 +197,100 @@ int main(int argc, char **argv)
 	sigaction(SIGHUP, &sa, nullptr);
 	sigaction(SIGPIPE, &sa, nullptr);
 
+	if (config::convert_file.size() > 0) {
+		if (config::restore_file.empty())
+			usage();
+		return convert(config::restore_file, config::convert_file);
+	}
+
 	if (!l4addr.size() && !l6addr.size())
 		usage();
 
-	global::logger.init(config::log_file);
-	global::logger.logit("main:", "Starting scan.");
+	// before the log and the dump are opened, as that truncates the dump
+	if (config::threads < 1 || config::threads > 1024)
+		usage();
+	if (config::min_conns > config::max_conns)
+		usage();
+
+	if (global::logger.levels(config::log_levels) < 0)
+		usage();
+	global::logger.init(config::log_file, config::async_log);
+	LOG_INFO(logtag::main, "Starting scan.");
 
 	cout<<"Starting scan. Check "<<config::log_file<<" for progress.\n";
 
-	btc_scan btcm;
-	if (btcm.init(l4addr, lport, l6addr, lport) < 0) {
-		cerr<<"Error "<<btcm.why()<<endl;
+	if (global::writer.init(config::dump_file, config::fsync_interval) < 0) {
+		cerr<<"Error: Unable to open "<<config::dump_file<<": "<<strerror(errno)<<endl;
 		exit(1);
 	}
 
-	if (seeds.size() > 0)
-		btcm.seed_nodes(seeds);
+	node_db ndb(config::threads);
+	if (ndb.init(config::frontier) < 0) {
+		cerr<<"Error: Unknown frontier policy '"<<config::frontier<<"'.\n";
+		exit(1);
+	}
+
+	if (global::stats.init(config::threads) < 0) {
+		cerr<<"Error: OOM\n";
+		exit(1);
+	}
+	global::stats.gauge("hoschi_frontier_nodes", "Nodes waiting to be connected.", [&ndb]{ return ndb.queued(); });
+	global::stats.gauge("hoschi_active_nodes", "Nodes taken by a shard and not finished yet.", [&ndb]{ return ndb.active(); });
+	global::stats.gauge("hoschi_handled_nodes", "Nodes connected at least once.", [&ndb]{ return ndb.handled_nodes(); });
+	global::stats.gauge("hoschi_known_nodes", "Distinct nodes seen.", [&ndb]{ return ndb.size(); });
+
+	// one engine per thread, each with its own sockets and FSM's
+	vector<unique_ptr<btc_scan>> shards;
+	for (unsigned int i = 0; i < config::threads; ++i) {
+		shards.emplace_back(new btc_scan(&ndb, i));
+		if (shards[i]->init(config::engine, l4addr, lport, l6addr, lport) < 0) {
+			cerr<<"Error "<<shards[i]->why()<<endl;
+			exit(1);
+		}
+	}
+
+	btc_scan &btcm = *shards[0];
+
+	if (seeds.size() > 0 && btcm.seed_nodes(seeds) < 0) {
+		cerr<<"Error "<<btcm.why()<<endl;
+		exit(1);
+	}
 
 	if (config::restore_file.size() > 0)
 		btcm.restore_nodes(config::restore_file);
 
+	if (global::stats.start(config::metrics_addr, config::stats_interval) < 0) {
+		cerr<<"Error: "<<global::stats.why()<<endl;
+		exit(1);
+	}
+
+	vector<thread> workers;
+	for (unsigned int i = 1; i < shards.size(); ++i) {
+		btc_scan *shard = shards[i].get();
+		workers.emplace_back([shard]{
+			if (shard->loop() < 0)
+				cerr<<"Error in scan engine: "<<shard->why()<<endl;
+		});
+	}
+
 	if (btcm.loop() < 0)
 		cerr<<"Error in scan engine: "<<btcm.why()<<endl;
 
+	for (auto &w : workers)
+		w.join();
+
+	global::writer.stop();
+	global::stats.stop();
+
 	cout<<"scan engine exited gracefully.\n";
-	global::logger.logit("main:", "Graceful end of scan.");
+	LOG_INFO(logtag::main, "Wrote " + to_string(global::writer.records()) + " results in " +
+	         to_string(global::writer.batches()) + " batches to " + config::dump_file + ".");
+	LOG_INFO(logtag::main, "Saw " + to_string(ndb.size()) + " distinct nodes.");
+	LOG_INFO(logtag::stats, global::stats.line());
+	for (const auto &h : global::stats.histograms())
+		LOG_INFO(logtag::stats, h);
+	LOG_INFO(logtag::main, "Graceful end of scan.");
+	global::logger.stop();
 	return 0;
 }
 
@@ -0,0 +1,284 @@
+/*
+ * This file is part of the hoschi p2p scan engine.
+ *
+ * (C) 2019 by Sebastian Krahmer,
+ *             sebastian [dot] krahmer [at] gmail [dot] com
+ *
+ * hoschi is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * hoschi is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with hoschi. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <new>
+#include <string>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <cstdio>
+#include <cerrno>
+#include <cstring>
+#include <time.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include "metrics.h"
+#include "node-addr.h"
+#include "global.h"
+#include "misc.h"
+
+
+using namespace std;
+
+
+namespace hoschi {
+
+
+static const struct {
+	const char *name, *type, *help;
+} counter_info[metric::max_counter] = {
+	{"hoschi_connects_total", "counter", "Connects attempted."},
+	{"hoschi_connects_ok_total", "counter", "Connects established."},
+	{"hoschi_connects_failed_total", "counter", "Connects that failed or timed out."},
+	{"hoschi_handshakes_total", "counter", "Handshakes completed (verack received)."},
+	{"hoschi_addr_msgs_total", "counter", "addr msgs received."},
+	{"hoschi_addrs_total", "counter", "Valid addresses parsed from addr msgs."},
+	{"hoschi_addrs_new_total", "counter", "Parsed addresses that were not known before."},
+	{"hoschi_addrs_dup_total", "counter", "Parsed addresses that were known already."},
+	{"hoschi_bytes_in_total", "counter", "Bytes received."},
+	{"hoschi_bytes_out_total", "counter", "Bytes sent."},
+	{"hoschi_reconnects_total", "counter", "Reconnects attempted."}
+};
+
+static const struct {
+	const char *name, *help;
+} hist_info[metric::max_hist] = {
+	{"hoschi_connect_rtt_microseconds", "Time from connect() until the TCP connect completed."},
+	{"hoschi_version_rtt_microseconds", "Time from our version sent until the peer's version arrived."},
+	{"hoschi_addr_wait_microseconds", "Time from verack received until the first addr msg arrived."},
+	{"hoschi_session_microseconds", "Lifetime of connected nodes, from connect() until closed."},
+	{"hoschi_addr_payload_bytes", "Payload size of addr msgs."}
+};
+
+static const char *live_names[metric::max_live] = {"connecting", "handshake", "reading", "writing"};
+
+
+metrics::~metrics()
+{
+	stop();
+}
+
+
+int metrics::init(unsigned shards)
+{
+	m_live.reset(new (nothrow) atomic<uint32_t>[shards*metric::max_live]);
+	if (!m_live.get())
+		return -1;
+	for (unsigned i = 0; i < shards*metric::max_live; ++i)
+		m_live[i].store(0, memory_order_relaxed);
+	m_shards = shards;
+	return 0;
+}
+
+
+uint32_t metrics::live(int state)
+{
+	uint32_t n = 0;
+	for (unsigned i = 0; i < m_shards; ++i)
+		n += m_live[i*metric::max_live + state].load(memory_order_relaxed);
+	return n;
+}
+
+
+void metrics::gauge(const string &name, const string &help, function<uint64_t()> f)
+{
+	m_gauges.push_back(make_pair(name, make_pair(help, f)));
+}
+
+
+string metrics::text()
+{
+	string s = "";
+
+	for (int i = 0; i < metric::max_counter; ++i) {
+		s += string("# HELP ") + counter_info[i].name + " " + counter_info[i].help + "\n";
+		s += string("# TYPE ") + counter_info[i].name + " " + counter_info[i].type + "\n";
+		s += string(counter_info[i].name) + " " + to_string(get(i)) + "\n";
+	}
+
+	s += "# HELP hoschi_live_sockets Sockets per FSM state.\n# TYPE hoschi_live_sockets gauge\n";
+	for (int i = 0; i < metric::max_live; ++i)
+		s += string("hoschi_live_sockets{state=\"") + live_names[i] + "\"} " + to_string(live(i)) + "\n";
+
+	// buckets at powers of two, where the histogram has exact bucket bounds
+	for (int i = 0; i < metric::max_hist; ++i) {
+		histogram &h = m_hists[i];
+		string name = hist_info[i].name;
+		s += "# HELP " + name + " " + hist_info[i].help + "\n# TYPE " + name + " histogram\n";
+		for (int k = 0; k < 64; ++k) {
+			uint64_t le = (uint64_t(1)<<k) - 1;
+			s += name + "_bucket{le=\"" + to_string(le) + "\"} " + to_string(h.count_upto(le)) + "\n";
+			if (le >= h.max())
+				break;
+		}
+		s += name + "_bucket{le=\"+Inf\"} " + to_string(h.count()) + "\n";
+		s += name + "_sum " + to_string(h.sum()) + "\n";
+		s += name + "_count " + to_string(h.count()) + "\n";
+	}
+
+	for (const auto &g : m_gauges) {
+		s += "# HELP " + g.first + " " + g.second.first + "\n";
+		s += "# TYPE " + g.first + " gauge\n";
+		s += g.first + " " + to_string(g.second.second()) + "\n";
+	}
+
+	return s;
+}
+
+
+string metrics::line()
+{
+	uint32_t nlive = 0;
+	for (int i = 0; i < metric::max_live; ++i)
+		nlive += live(i);
+
+	string s = "connects " + to_string(get(metric::connects)) + " (ok " + to_string(get(metric::connects_ok)) +
+	           ", failed " + to_string(get(metric::connects_failed)) + ", reconnects " + to_string(get(metric::reconnects)) +
+	           "), handshakes " + to_string(get(metric::handshakes)) + ", addr msgs " + to_string(get(metric::addr_msgs)) +
+	           ", addrs " + to_string(get(metric::addrs)) + " (new " + to_string(get(metric::addrs_new)) +
+	           "), in " + to_string(get(metric::bytes_in)>>10) + "k, out " + to_string(get(metric::bytes_out)>>10) +
+	           "k, live " + to_string(nlive);
+
+	// without the "hoschi_" prefix
+	for (const auto &g : m_gauges)
+		s += ", " + g.first.substr(g.first.find('_') + 1) + " " + to_string(g.second.second());
+	return s;
+}
+
+
+vector<string> metrics::histograms()
+{
+	vector<string> v;
+
+	// without the "hoschi_" prefix
+	for (int i = 0; i < metric::max_hist; ++i) {
+		string name = hist_info[i].name;
+		v.push_back(name.substr(name.find('_') + 1) + ": " + m_hists[i].summary());
+	}
+
+	return v;
+}
+
+
+int metrics::start(const string &addr, int interval)
+{
+	m_interval = interval;
+
+	if (addr.size() > 0) {
+		node_addr na;
+		sockaddr_storage ss;
+		int one = 1;
+
+		if (na.from_str(addr) < 0) {
+			m_err = "metrics::start: Invalid address " + addr;
+			return -1;
+		}
+		socklen_t slen = na.to_sockaddr(ss);
+
+		if ((m_fd = socket(na.family(), SOCK_STREAM|SOCK_CLOEXEC, 0)) < 0 ||
+		    setsockopt(m_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) < 0 ||
+		    ::bind(m_fd, reinterpret_cast<sockaddr *>(&ss), slen) < 0 || listen(m_fd, 16) < 0) {
+			m_err = string("metrics::start: ") + strerror(errno);
+			if (m_fd >= 0)
+				close(m_fd);
+			m_fd = -1;
+			return -1;
+		}
+	}
+
+	if (m_fd >= 0 || m_interval > 0)
+		m_thread = thread(&metrics::run, this);
+	return 0;
+}
+
+
+// answer one scrape; anything but GET /metrics gets a 404
+void metrics::serve_one()
+{
+	int cfd = accept4(m_fd, nullptr, nullptr, SOCK_CLOEXEC);
+	if (cfd < 0)
+		return;
+
+	// don't let a slow client stall the stats line
+	timeval tv{1, 0};
+	setsockopt(cfd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	setsockopt(cfd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+	char req[1024] = {0};
+	ssize_t r = read(cfd, req, sizeof(req) - 1);
+
+	string body = "", status = "404 Not Found";
+	if (r > 0 && strncmp(req, "GET /metrics", 12) == 0 && (req[12] == ' ' || req[12] == '?')) {
+		body = text();
+		status = "200 OK";
+	}
+
+	string resp = "HTTP/1.0 " + status + "\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: " +
+	              to_string(body.size()) + "\r\nConnection: close\r\n\r\n" + body;
+
+	for (size_t off = 0; off < resp.size();) {
+		ssize_t w = write(cfd, resp.c_str() + off, resp.size() - off);
+		if (w <= 0)
+			break;
+		off += w;
+	}
+	close(cfd);
+}
+
+
+void metrics::run()
+{
+	time_t next = time(nullptr) + m_interval;
+
+	while (!m_stop.load(memory_order_acquire)) {
+		if (m_fd >= 0) {
+			pollfd pfd{m_fd, POLLIN, 0};
+			if (poll(&pfd, 1, timeouts::metrics_idle) == 1)
+				serve_one();
+		} else
+			this_thread::sleep_for(chrono::milliseconds(timeouts::metrics_idle));
+
+		if (m_interval > 0 && time(nullptr) >= next) {
+			LOG_INFO(logtag::stats, line());
+			next += m_interval;
+		}
+	}
+}
+
+
+void metrics::stop()
+{
+	if (m_thread.joinable()) {
+		m_stop.store(1, memory_order_release);
+		m_thread.join();
+	}
+
+	if (m_fd >= 0)
+		close(m_fd);
+	m_fd = -1;
+}
+
+
+}
+
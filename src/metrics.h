@@ -0,0 +1,173 @@
+/*
+ * This file is part of the hoschi p2p scan engine.
+ *
+ * (C) 2019 by Sebastian Krahmer,
+ *             sebastian [dot] krahmer [at] gmail [dot] com
+ *
+ * hoschi is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * hoschi is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with hoschi. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef hoschi_metrics_h
+#define hoschi_metrics_h
+
+#include <string>
+#include <vector>
+#include <atomic>
+#include <thread>
+#include <memory>
+#include <utility>
+#include <functional>
+#include <cstdint>
+#include <time.h>
+#include "histogram.h"
+
+
+namespace hoschi {
+
+
+namespace metric {
+
+// counters
+enum : int {
+	connects = 0,		// connects attempted
+	connects_ok,
+	connects_failed,	// connect(), finish_connect() or connect timeout failed
+	handshakes,		// verack received
+	addr_msgs,
+	addrs,			// valid addresses parsed from addr msgs
+	addrs_new,		// ... that were not known yet
+	addrs_dup,
+	bytes_in,
+	bytes_out,
+	reconnects,
+	max_counter
+};
+
+// histograms, latencies in us
+enum : int {
+	connect_rtt = 0,	// connect() until the TCP connect completed
+	version_rtt,		// our version sent until theirs arrived
+	addr_wait,		// verack received until the first addr
+	session,		// connect() until the node is closed, if it ever connected
+	addr_bytes,		// payload size of addr msgs
+	max_hist
+};
+
+// live sockets, published by each shard
+enum : int {
+	live_connecting = 0,
+	live_handshake,		// connected, sending version
+	live_reading,
+	live_writing,
+	max_live
+};
+
+}
+
+
+// Counters and histograms of the scan engine. Updates are relaxed atomic
+// increments, each counter in its own cache line, so they can stay on. A thread of its own
+// serves them in Prometheus text format via HTTP and logs a stats line.
+class metrics {
+
+	struct alignas(64) counter {
+		std::atomic<uint64_t> v{0};
+	};
+
+	counter m_counters[metric::max_counter];
+
+	histogram m_hists[metric::max_hist];
+
+	// per shard and metric::max_live
+	std::unique_ptr<std::atomic<uint32_t>[]> m_live;
+	unsigned m_shards{0};
+
+	// name, help and getter; registered before serving
+	std::vector<std::pair<std::string, std::pair<std::string, std::function<uint64_t()>>>> m_gauges;
+
+	int m_fd{-1};
+
+	int m_interval{0};
+
+	std::atomic<bool> m_stop{0};
+
+	std::thread m_thread;
+
+	std::string m_err{""};
+
+	void serve_one();
+
+	void run();
+
+public:
+
+	metrics()
+	{
+	}
+
+	virtual ~metrics();
+
+	int init(unsigned);
+
+	void inc(int id, uint64_t n = 1)
+	{
+		m_counters[id].v.fetch_add(n, std::memory_order_relaxed);
+	}
+
+	uint64_t get(int id)
+	{
+		return m_counters[id].v.load(std::memory_order_relaxed);
+	}
+
+	void observe(int id, uint64_t v)
+	{
+		m_hists[id].record(v);
+	}
+
+	void live(unsigned shard, int state, uint32_t n)
+	{
+		m_live[shard*metric::max_live + state].store(n, std::memory_order_relaxed);
+	}
+
+	uint32_t live(int);
+
+	// a value that is read when it's needed, e.g. sizes of the node db
+	void gauge(const std::string &, const std::string &, std::function<uint64_t()>);
+
+	// listen on "[ip]:port" if not empty and log a stats line every
+	// interval seconds if > 0
+	int start(const std::string &, int);
+
+	void stop();
+
+	// all metrics in Prometheus text format
+	std::string text();
+
+	// a one line summary
+	std::string line();
+
+	// a summary line per histogram
+	std::vector<std::string> histograms();
+
+	const char *why()
+	{
+		return m_err.c_str();
+	}
+};
+
+
+}
+
+#endif
+
@@ -33,14 +33,18 @@ template<typename T> using free_ptr = std::unique_ptr<T, void (*)(T *)>;
 
 namespace timeouts {
 
+// all in milliseconds
 enum : uint32_t {
 	none		= 0,
-	connect		= 30,
-	verack		= 120,
-	dead		= 180,
+	connect		= 30000,
+	verack		= 120000,
+	dead		= 180000,
 	tx_complete	= dead,
 	rx_complete	= dead,
-	fin_wait	= 60,		// /proc/sys/net/ipv4/tcp_fin_timeout
+	fin_wait	= 60000,	// /proc/sys/net/ipv4/tcp_fin_timeout
+	writer_idle	= 50,		// result writer sleep when nothing is queued
+	log_idle	= 20,		// async log drain sleep when nothing is queued
+	metrics_idle	= 200,		// metrics thread wakeup to check for stop and stats line
 
 };
 
@@ -49,11 +53,31 @@ enum : uint32_t {
 namespace numbers {
 
 enum {
-	max_send_size	= 0x1000,
+	max_iov		= 16,		// msgs per writev()
 	max_paylen	= 0x10000,
 	max_rx_size	= 0x1000,
-
-	btc_reconnects	= 7
+	max_pooled_rx	= 0x8000,	// rx buffers kept by recycled nodes; fits a full addr msg
+	max_events	= 0x400,	// fd's per epoll_wait() round
+	max_io_rounds	= 16,		// I/O rounds per node and wakeup before others get their turn
+
+	btc_reconnects	= 7,
+
+	db_stripes	= 64,		// lock stripes of the node table
+	max_connects	= 256,		// connects per engine round
+	slab_size	= 256,		// objects per slab of a slab_pool
+	max_write_batch	= 0x100000,	// bytes per write() of the result writer
+	min_restore_chunk= 0x400000,	// bytes of a nodemap per restore thread, at least
+	log_ring	= 0x2000,	// lines the async log can queue; power of 2
+	log_slot	= 492,		// bytes of msg per queued log line
+	log_burst	= 10,		// lines per second of a rate limited log call site
+	hist_sub_bits	= 4,		// histogram buckets per power of two: 2^hist_sub_bits
+
+	aimd_window	= 2000,		// ms between rate adaptions
+	aimd_min_samples= 16,
+	aimd_margin	= 15,		// % failure ratio above normal to be taken as loss
+	aimd_decrease	= 50,		// % of rate and ceiling that is left on loss
+	aimd_rate_step	= 4,		// connects/s added per loss free window
+	aimd_conns_step	= 64
 };
 
 }
@@ -0,0 +1,135 @@
+/*
+ * This file is part of the hoschi p2p scan engine.
+ *
+ * (C) 2019 by Sebastian Krahmer,
+ *             sebastian [dot] krahmer [at] gmail [dot] com
+ *
+ * hoschi is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * hoschi is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with hoschi. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string>
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <cstdint>
+#include <arpa/inet.h>
+#include "node-addr.h"
+
+
+using namespace std;
+
+
+namespace hoschi {
+
+
+static const uint8_t v4_mapped[12] = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xff, 0xff};
+
+
+bool node_addr::is_v4() const
+{
+	return memcmp(ip, v4_mapped, sizeof(v4_mapped)) == 0;
+}
+
+
+socklen_t node_addr::to_sockaddr(sockaddr_storage &ss) const
+{
+	memset(&ss, 0, sizeof(ss));
+
+	if (is_v4()) {
+		auto *sin = reinterpret_cast<sockaddr_in *>(&ss);
+		sin->sin_family = AF_INET;
+		sin->sin_port = port;
+		memcpy(&sin->sin_addr, ip + 12, 4);
+		return sizeof(*sin);
+	}
+
+	auto *sin6 = reinterpret_cast<sockaddr_in6 *>(&ss);
+	sin6->sin6_family = AF_INET6;
+	sin6->sin6_port = port;
+	memcpy(&sin6->sin6_addr, ip, 16);
+	return sizeof(*sin6);
+}
+
+
+string node_addr::str() const
+{
+	char dst[INET6_ADDRSTRLEN] = {0}, s[INET6_ADDRSTRLEN + 16] = {0};
+
+	if (is_v4())
+		inet_ntop(AF_INET, ip + 12, dst, sizeof(dst));
+	else
+		inet_ntop(AF_INET6, ip, dst, sizeof(dst));
+
+	snprintf(s, sizeof(s), "[%s]:%hu", dst, ntohs(port));
+	return s;
+}
+
+
+int node_addr::from_str(const string &node)
+{
+	return from_str(node.c_str(), node.size());
+}
+
+
+int node_addr::from_str(const char *s, size_t len)
+{
+	if (len < 5 || s[0] != '[')
+		return -1;
+
+	const char *end = s + len, *colon = static_cast<const char *>(memchr(s, ']', len));
+	if (!colon || colon + 2 >= end || colon[1] != ':')
+		return -1;
+
+	char host[INET6_ADDRSTRLEN] = {0};
+	size_t hlen = colon - s - 1;
+	if (hlen >= sizeof(host))
+		return -1;
+	memcpy(host, s + 1, hlen);
+
+	unsigned long p = 0;
+	for (const char *d = colon + 2; d < end; ++d) {
+		if (*d < '0' || *d > '9' || p > 0xffff)
+			return -1;
+		p = p*10 + *d - '0';
+	}
+	if (p == 0 || p > 0xffff)
+		return -1;
+
+	if (inet_pton(AF_INET, host, ip + 12) == 1)
+		memcpy(ip, v4_mapped, sizeof(v4_mapped));
+	else if (inet_pton(AF_INET6, host, ip) != 1)
+		return -1;
+
+	port = htons(p);
+	return 0;
+}
+
+
+// FNV-1a
+size_t node_addr::hash() const
+{
+	auto *p = reinterpret_cast<const uint8_t *>(this);
+	uint64_t h = 0xcbf29ce484222325ULL;
+
+	for (size_t i = 0; i < sizeof(*this); ++i) {
+		h ^= p[i];
+		h *= 0x100000001b3ULL;
+	}
+
+	return h;
+}
+
+
+}
+
@@ -0,0 +1,86 @@
+/*
+ * This file is part of the hoschi p2p scan engine.
+ *
+ * (C) 2019 by Sebastian Krahmer,
+ *             sebastian [dot] krahmer [at] gmail [dot] com
+ *
+ * hoschi is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * hoschi is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with hoschi. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef hoschi_node_addr_h
+#define hoschi_node_addr_h
+
+#include <string>
+#include <cstring>
+#include <cstdint>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+
+namespace hoschi {
+
+
+// Binary address of a node as found in addr msgs: an IPv6 or IPv4-mapped
+// IPv6 address and the port, both in network byte order. Nodes are carried
+// like this from the addr parser to connect(), text is only made for logging
+// and dumping.
+struct node_addr {
+	uint8_t ip[16]{0};
+	uint16_t port{0};
+
+	bool is_v4() const;
+
+	int family() const
+	{
+		return is_v4() ? AF_INET : AF_INET6;
+	}
+
+	// fill in sockaddr_in or sockaddr_in6 and return its length
+	socklen_t to_sockaddr(sockaddr_storage &) const;
+
+	// "[ip]:port"
+	std::string str() const;
+
+	// parse "[ip]:port", -1 if invalid
+	int from_str(const std::string &);
+
+	int from_str(const char *, size_t);
+
+	size_t hash() const;
+
+	// the /16 of IPv4 and the /32 of IPv6 addresses; IPv4 ones have bit 32
+	// set, so they don't collide with IPv6 /32s that start with 0000
+	uint64_t prefix() const
+	{
+		if (is_v4())
+			return (uint64_t(1)<<32)|(ip[12]<<8)|ip[13];
+		return (uint32_t(ip[0])<<24)|(ip[1]<<16)|(ip[2]<<8)|ip[3];
+	}
+
+	bool operator<(const node_addr &o) const
+	{
+		return memcmp(this, &o, sizeof(*this)) < 0;
+	}
+
+	bool operator==(const node_addr &o) const
+	{
+		return memcmp(this, &o, sizeof(*this)) == 0;
+	}
+} __attribute__((packed));
+
+
+}
+
+#endif
+
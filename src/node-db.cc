@@ -0,0 +1,358 @@
+/*
+ * This file is part of the hoschi p2p scan engine.
+ *
+ * (C) 2019 by Sebastian Krahmer,
+ *             sebastian [dot] krahmer [at] gmail [dot] com
+ *
+ * hoschi is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * hoschi is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with hoschi. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <mutex>
+#include <string>
+#include <vector>
+#include <time.h>
+#include "node-db.h"
+
+
+using namespace std;
+
+
+namespace hoschi {
+
+
+// Lock order: never hold a stripe and a shard lock at the same time.
+
+
+uint32_t node_db::intern(stripe &st, uint32_t sno, const node_addr &node, uint64_t h)
+{
+	uint32_t idx = st.nodes.insert(node, h);
+
+	if (idx == st.handled.size()) {
+		st.handled.push_back(0);
+		st.learned.push_back(0);
+		st.seen.push_back(0);
+		st.services.push_back(0);
+	}
+
+	return idx*numbers::db_stripes + sno;
+}
+
+
+frontier::entry node_db::entry_of(stripe &st, uint32_t id)
+{
+	frontier::entry e;
+	uint32_t idx = index_of(id);
+
+	e.id = id;
+	e.time = st.seen[idx];
+	e.prefix = st.nodes.at(idx).prefix();
+	e.services = st.services[idx];
+	return e;
+}
+
+
+void node_db::enqueue(const frontier::entry &e)
+{
+	shard &sh = m_shards[e.id % m_shards.size()];
+	lock_guard<mutex> g(sh.lock);
+	sh.nodes->push(e);
+}
+
+
+int node_db::init(const string &policy)
+{
+	for (auto &sh : m_shards) {
+		sh.nodes.reset(make_frontier(policy));
+		if (!sh.nodes.get())
+			return -1;
+	}
+	return 0;
+}
+
+
+bool node_db::handled(const node_addr &node)
+{
+	uint64_t h = node.hash();
+	stripe &st = m_stripes[h % numbers::db_stripes];
+	lock_guard<mutex> g(st.lock);
+
+	uint32_t idx = st.nodes.find(node, h);
+	return idx != node_table::npos && st.handled[idx] > 0;
+}
+
+
+bool node_db::learned(const node_addr &node)
+{
+	uint64_t h = node.hash();
+	stripe &st = m_stripes[h % numbers::db_stripes];
+	lock_guard<mutex> g(st.lock);
+
+	uint32_t idx = st.nodes.find(node, h);
+	return idx != node_table::npos && st.learned[idx];
+}
+
+
+bool node_db::learn(const node_addr &node, uint32_t time, uint64_t services)
+{
+	uint64_t h = node.hash();
+	uint32_t sno = h % numbers::db_stripes;
+	frontier::entry e;
+	{
+		stripe &st = m_stripes[sno];
+		lock_guard<mutex> g(st.lock);
+
+		uint32_t idx = index_of(intern(st, sno, node, h));
+		if (time > st.seen[idx])
+			st.seen[idx] = time;
+		st.services[idx] |= services & 0xff;
+
+		if (st.handled[idx] > 0 || st.learned[idx])
+			return 0;
+		st.learned[idx] = 1;
+		e = entry_of(st, idx*numbers::db_stripes + sno);
+	}
+
+	++m_pending;
+	++m_queued;
+	enqueue(e);
+	return 1;
+}
+
+
+void node_db::restore_handled(const node_addr &node)
+{
+	uint64_t h = node.hash();
+	uint32_t sno = h % numbers::db_stripes;
+	stripe &st = m_stripes[sno];
+	lock_guard<mutex> g(st.lock);
+
+	uint32_t idx = index_of(intern(st, sno, node, h));
+	if (st.handled[idx] == 0)
+		++m_handled;
+	if (st.handled[idx] < 0xff)
+		++st.handled[idx];
+}
+
+
+void node_db::restore_learned(const node_addr &node)
+{
+	uint64_t h = node.hash();
+	uint32_t sno = h % numbers::db_stripes;
+	frontier::entry e;
+	{
+		stripe &st = m_stripes[sno];
+		lock_guard<mutex> g(st.lock);
+
+		uint32_t id = intern(st, sno, node, h), idx = index_of(id);
+		if (st.handled[idx] >= m_reconnects || st.learned[idx])
+			return;
+		st.learned[idx] = 1;
+		e = entry_of(st, id);
+	}
+
+	++m_pending;
+	++m_queued;
+	enqueue(e);
+}
+
+
+// move half of the largest other frontier over to shard 'to'
+size_t node_db::steal(unsigned to)
+{
+	unsigned victim = to;
+	size_t max = 0;
+
+	for (unsigned i = 0; i < m_shards.size(); ++i) {
+		if (i == to)
+			continue;
+		lock_guard<mutex> g(m_shards[i].lock);
+		if (m_shards[i].nodes->size() > max) {
+			max = m_shards[i].nodes->size();
+			victim = i;
+		}
+	}
+
+	if (victim == to)
+		return 0;
+
+	vector<frontier::entry> loot;
+	{
+		lock_guard<mutex> g(m_shards[victim].lock);
+		frontier::entry e;
+		for (size_t n = (m_shards[victim].nodes->size() + 1)/2; n > 0 && m_shards[victim].nodes->pop(e); --n)
+			loot.push_back(e);
+	}
+
+	lock_guard<mutex> g(m_shards[to].lock);
+	for (const auto &e : loot)
+		m_shards[to].nodes->push(e);
+
+	return loot.size();
+}
+
+
+size_t node_db::take(unsigned sh, time_t now, size_t n, vector<candidate> &nodes)
+{
+	nodes.clear();
+
+	if (sh >= m_shards.size() || n == 0)
+		return 0;
+
+	{
+		lock_guard<mutex> g(m_shards[sh].lock);
+		m_shards[sh].delayed.release(now, *m_shards[sh].nodes);
+	}
+
+	// Pop in the order of the frontier policy. Nodes that used up their
+	// reconnects are dropped and don't count against n, or a frontier full
+	// of them would only drain at the pace of the connects.
+	vector<frontier::entry> batch;
+	bool stolen = 0;
+	candidate c;
+
+	while (nodes.size() < n) {
+		batch.clear();
+		{
+			lock_guard<mutex> g(m_shards[sh].lock);
+			frontier::entry e;
+			for (size_t k = nodes.size(); k < n && m_shards[sh].nodes->pop(e); ++k)
+				batch.push_back(e);
+		}
+
+		if (batch.empty()) {
+			if (stolen || steal(sh) == 0)
+				break;
+			stolen = 1;
+			continue;
+		}
+
+		for (const auto &e : batch) {
+
+			stripe &st = stripe_of(e.id);
+			lock_guard<mutex> g(st.lock);
+			uint32_t idx = index_of(e.id);
+
+			st.learned[idx] = 0;
+
+			if (st.handled[idx] >= m_reconnects) {
+				--m_queued;
+				--m_pending;
+				continue;
+			}
+
+			c.id = e.id;
+			c.node = st.nodes.at(idx);
+			c.handled = st.handled[idx];
+
+			// reserve the connect, so no other shard may learn it again meanwhile
+			if (st.handled[idx] == 0)
+				++m_handled;
+			++st.handled[idx];
+
+			// active before it leaves the queue, as give_back() and reconnect()
+			// queue before they release
+			++m_active;
+			--m_queued;
+
+			nodes.push_back(c);
+		}
+	}
+
+	return nodes.size();
+}
+
+
+void node_db::give_back(uint32_t id, bool requeue)
+{
+	frontier::entry e;
+	{
+		stripe &st = stripe_of(id);
+		lock_guard<mutex> g(st.lock);
+		uint32_t idx = index_of(id);
+
+		if (st.handled[idx] > 0 && --st.handled[idx] == 0)
+			--m_handled;
+		if (requeue) {
+			if (st.learned[idx])
+				requeue = 0;
+			st.learned[idx] = 1;
+			e = entry_of(st, id);
+		}
+	}
+
+	if (requeue) {
+		++m_queued;
+		enqueue(e);
+	} else
+		--m_pending;
+	--m_active;
+}
+
+
+void node_db::retire(uint32_t id)
+{
+	{
+		stripe &st = stripe_of(id);
+		lock_guard<mutex> g(st.lock);
+
+		st.handled[index_of(id)] = m_reconnects;
+	}
+	--m_active;
+	--m_pending;
+}
+
+
+void node_db::reconnect(uint32_t id, time_t due)
+{
+	bool requeue = 0;
+	frontier::entry e;
+	{
+		stripe &st = stripe_of(id);
+		lock_guard<mutex> g(st.lock);
+		uint32_t idx = index_of(id);
+
+		// used up its reconnects, so it would only be dropped by take()
+		if (!st.learned[idx] && st.handled[idx] < m_reconnects) {
+			requeue = 1;
+			st.learned[idx] = 1;
+			e = entry_of(st, id);
+		}
+	}
+
+	if (requeue) {
+		++m_queued;
+		shard &sh = m_shards[id % m_shards.size()];
+		lock_guard<mutex> g(sh.lock);
+		sh.delayed.push(due, e);
+	} else
+		--m_pending;
+	--m_active;
+}
+
+
+size_t node_db::size()
+{
+	size_t n = 0;
+
+	for (auto &st : m_stripes) {
+		lock_guard<mutex> g(st.lock);
+		n += st.nodes.size();
+	}
+
+	return n;
+}
+
+
+}
+
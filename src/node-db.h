@@ -0,0 +1,186 @@
+/*
+ * This file is part of the hoschi p2p scan engine.
+ *
+ * (C) 2019 by Sebastian Krahmer,
+ *             sebastian [dot] krahmer [at] gmail [dot] com
+ *
+ * hoschi is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * hoschi is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with hoschi. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef hoschi_nodedb_h
+#define hoschi_nodedb_h
+
+#include <string>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <vector>
+#include <cstdint>
+#include <time.h>
+#include "node-addr.h"
+#include "node-table.h"
+#include "frontier.h"
+#include "misc.h"
+
+
+namespace hoschi {
+
+
+// The handled/learned bookkeeping of all nodes, shared by all scan engine
+// shards. Nodes are interned into 32 bit IDs, which index flat per-node state
+// arrays. The node table is striped by hash so shards rarely contend for
+// the same lock, and the stripe is encoded in the low bits of the ID. Each
+// shard has its own frontier of learned nodes and steals from the others once
+// it runs dry. In which order a shard connects to its learned nodes is up to
+// its frontier policy.
+class node_db {
+
+	struct stripe {
+		std::mutex lock;
+		node_table nodes;
+
+		// per-node state, indexed like nodes
+		std::vector<uint8_t> handled;	// number of connects, or max reconnects for bad nodes
+		std::vector<uint8_t> learned;	// sitting in a frontier
+		std::vector<uint32_t> seen;	// latest gossiped time
+		std::vector<uint8_t> services;	// low bits of advertised services
+	};
+
+	struct shard {
+		std::mutex lock;
+		std::unique_ptr<frontier> nodes;
+
+		// reconnects that are not eligible yet
+		delay_queue delayed;
+	};
+
+	stripe m_stripes[numbers::db_stripes];
+
+	std::vector<shard> m_shards;
+
+	uint32_t m_reconnects{numbers::btc_reconnects};
+
+	// nodes in any frontier, and nodes taken by a shard but not yet finished
+	std::atomic<size_t> m_queued{0}, m_active{0};
+
+	// nodes in either of them. Nodes move between m_queued and m_active
+	// in both directions, from several threads, so no order of reading the
+	// two sees them both at 0 only when the scan is done.
+	std::atomic<size_t> m_pending{0};
+
+	// nodes connected at least once
+	std::atomic<size_t> m_handled{0};
+
+	static_assert((numbers::db_stripes & (numbers::db_stripes - 1)) == 0, "db_stripes must be a power of 2");
+
+	stripe &stripe_of(uint32_t id)
+	{
+		return m_stripes[id % numbers::db_stripes];
+	}
+
+	static uint32_t index_of(uint32_t id)
+	{
+		return id / numbers::db_stripes;
+	}
+
+	// ID of node, adding it if new; stripe st must be locked
+	uint32_t intern(stripe &, uint32_t, const node_addr &, uint64_t);
+
+	// what the frontier needs to know about a node; stripe st must be locked
+	frontier::entry entry_of(stripe &, uint32_t);
+
+	void enqueue(const frontier::entry &);
+
+	size_t steal(unsigned);
+
+public:
+
+	struct candidate {
+		uint32_t id{0};
+		node_addr node;
+		uint32_t handled{0};	// connects before this one
+	};
+
+	node_db(unsigned nshards = 1, uint32_t reconnects = numbers::btc_reconnects)
+		: m_shards(nshards ? nshards : 1), m_reconnects(reconnects > 0xff ? 0xff : reconnects)
+	{
+	}
+
+	virtual ~node_db()
+	{
+	}
+
+	// -1 if the frontier policy is unknown
+	int init(const std::string &);
+
+	unsigned shards()
+	{
+		return m_shards.size();
+	}
+
+	bool handled(const node_addr &);
+
+	bool learned(const node_addr &);
+
+	// learn node if not handled yet, with the gossiped time and services; true if it was queued
+	bool learn(const node_addr &, uint32_t, uint64_t);
+
+	// node was connected in a previous run
+	void restore_handled(const node_addr &);
+
+	// learn node if it didn't reach max reconnects in a previous run
+	void restore_learned(const node_addr &);
+
+	// fetch up to n nodes for shard that are eligible for connect at 'now' and
+	// have connects left
+	size_t take(unsigned, time_t, size_t, std::vector<candidate> &);
+
+	// a taken node could not be connected. Requeue it if the failure was ours.
+	void give_back(uint32_t, bool);
+
+	// a taken node is done; either for good or queued for reconnect
+	void retire(uint32_t);
+
+	// queue for reconnect, but not before the given time; nodes that used up
+	// their reconnects are only released
+	void reconnect(uint32_t, time_t);
+
+	bool done()
+	{
+		return m_pending == 0;
+	}
+
+	size_t queued()
+	{
+		return m_queued;
+	}
+
+	size_t active()
+	{
+		return m_active;
+	}
+
+	size_t handled_nodes()
+	{
+		return m_handled;
+	}
+
+	// number of distinct nodes seen so far
+	size_t size();
+};
+
+
+}
+
+#endif
@@ -0,0 +1,95 @@
+/*
+ * This file is part of the hoschi p2p scan engine.
+ *
+ * (C) 2019 by Sebastian Krahmer,
+ *             sebastian [dot] krahmer [at] gmail [dot] com
+ *
+ * hoschi is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * hoschi is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with hoschi. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <vector>
+#include <cstdint>
+#include "node-table.h"
+
+
+using namespace std;
+
+
+namespace hoschi {
+
+
+// the low bits are used to pick the db stripe already
+static inline size_t slot_of(uint64_t h)
+{
+	return h >> 16;
+}
+
+
+void node_table::grow()
+{
+	size_t n = m_slots.size() ? m_slots.size()*2 : 1024;
+
+	m_slots.assign(n, 0);
+	m_mask = n - 1;
+
+	for (uint32_t i = 0; i < m_addrs.size(); ++i) {
+		size_t s = slot_of(m_addrs[i].hash()) & m_mask;
+		while (m_slots[s] != 0)
+			s = (s + 1) & m_mask;
+		m_slots[s] = i + 1;
+	}
+}
+
+
+void node_table::clear()
+{
+	m_addrs.clear();
+	m_slots.assign(m_slots.size(), 0);
+}
+
+
+uint32_t node_table::find(const node_addr &node, uint64_t h)
+{
+	if (m_slots.empty())
+		return npos;
+
+	for (size_t s = slot_of(h) & m_mask; m_slots[s] != 0; s = (s + 1) & m_mask) {
+		if (m_addrs[m_slots[s] - 1] == node)
+			return m_slots[s] - 1;
+	}
+
+	return npos;
+}
+
+
+uint32_t node_table::insert(const node_addr &node, uint64_t h)
+{
+	// keep load factor below 1/2, so probe sequences stay short
+	if (2*(m_addrs.size() + 1) > m_slots.size())
+		grow();
+
+	size_t s = slot_of(h) & m_mask;
+	for (; m_slots[s] != 0; s = (s + 1) & m_mask) {
+		if (m_addrs[m_slots[s] - 1] == node)
+			return m_slots[s] - 1;
+	}
+
+	m_addrs.push_back(node);
+	m_slots[s] = m_addrs.size();
+	return m_addrs.size() - 1;
+}
+
+
+}
+
@@ -0,0 +1,83 @@
+/*
+ * This file is part of the hoschi p2p scan engine.
+ *
+ * (C) 2019 by Sebastian Krahmer,
+ *             sebastian [dot] krahmer [at] gmail [dot] com
+ *
+ * hoschi is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * hoschi is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with hoschi. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef hoschi_node_table_h
+#define hoschi_node_table_h
+
+#include <vector>
+#include <cstdint>
+#include "node-addr.h"
+
+
+namespace hoschi {
+
+
+// Interns node addresses: maps each address to a dense index, which can be
+// used to index flat arrays of per-node state. Open addressing with linear
+// probing; the slots only hold index + 1, the keys are kept in insertion
+// order so the table can be rebuilt from them when it grows.
+// Not thread safe, the owner has to lock.
+class node_table {
+
+	std::vector<uint32_t> m_slots;
+
+	std::vector<node_addr> m_addrs;
+
+	size_t m_mask{0};
+
+	void grow();
+
+public:
+
+	enum : uint32_t { npos = 0xffffffff };
+
+	node_table()
+	{
+	}
+
+	virtual ~node_table()
+	{
+	}
+
+	// index of node with hash h, or npos
+	uint32_t find(const node_addr &, uint64_t h);
+
+	// index of node with hash h, adding it if not yet known
+	uint32_t insert(const node_addr &, uint64_t h);
+
+	const node_addr &at(uint32_t idx)
+	{
+		return m_addrs[idx];
+	}
+
+	size_t size()
+	{
+		return m_addrs.size();
+	}
+
+	// forget all nodes, but keep the memory
+	void clear();
+};
+
+
+}
+
+#endif
+
@@ -0,0 +1,314 @@
+/*
+ * This file is part of the hoschi p2p scan engine.
+ *
+ * (C) 2019 by Sebastian Krahmer,
+ *             sebastian [dot] krahmer [at] gmail [dot] com
+ *
+ * hoschi is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * hoschi is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with hoschi. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <cstdint>
+#include <algorithm>
+#include <endian.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "nodemap.h"
+
+
+using namespace std;
+
+
+namespace hoschi {
+
+
+static const char nodemap_magic[8] = {'h', 'o', 's', 'c', 'h', 'i', 'N', 'M'};
+
+enum : uint32_t { nodemap_version = 1 };
+
+
+int parse_nodemap_line(const char *s, size_t len, node_addr &node, uint32_t &version, vector<node_addr> &addrs)
+{
+	addrs.clear();
+	version = 0;
+
+	while (len > 0 && (s[len - 1] == '\n' || s[len - 1] == '\r'))
+		--len;
+
+	const char *end = s + len;
+	node_addr n;
+
+	for (bool first = 1; s < end; first = 0) {
+		const char *comma = static_cast<const char *>(memchr(s, ',', end - s));
+		if (!comma)
+			comma = end;
+		size_t flen = comma - s;
+
+		if (first) {
+			if (node.from_str(s, flen) < 0)
+				return -1;
+		} else if (flen > 8 && memcmp(s, "version=", 8) == 0)
+			version = strtoul(s + 8, nullptr, 10);
+		else if (n.from_str(s, flen) == 0)
+			addrs.push_back(n);	// also skips agent=
+
+		s = comma + 1;
+	}
+
+	return 0;
+}
+
+
+bool nodemap::probe(const string &path)
+{
+	char magic[sizeof(nodemap_magic)] = {0};
+
+	int fd = ::open(path.c_str(), O_RDONLY|O_CLOEXEC);
+	if (fd < 0)
+		return 0;
+	bool r = read(fd, magic, sizeof(magic)) == sizeof(magic) && memcmp(magic, nodemap_magic, sizeof(magic)) == 0;
+	::close(fd);
+	return r;
+}
+
+
+int nodemap::open(const string &path)
+{
+	close();
+
+	int fd = ::open(path.c_str(), O_RDONLY|O_CLOEXEC);
+	if (fd < 0)
+		return build_error("open:", -1);
+
+	struct stat st;
+	if (fstat(fd, &st) < 0) {
+		::close(fd);
+		return build_error("open: fstat", -1);
+	}
+
+	if (size_t(st.st_size) < sizeof(nodemap_header)) {
+		::close(fd);
+		return build_error("open: File too short.", -1);
+	}
+
+	void *map = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	::close(fd);
+	if (map == MAP_FAILED)
+		return build_error("open: mmap", -1);
+
+	m_map = static_cast<const char *>(map);
+	m_len = st.st_size;
+	m_hdr = reinterpret_cast<const nodemap_header *>(m_map);
+
+	uint64_t nodes = le64toh(m_hdr->nodes), nedges = le64toh(m_hdr->edges);
+	uint64_t noff = le64toh(m_hdr->nodes_off), eoff = le64toh(m_hdr->edges_off);
+
+	if (memcmp(m_hdr->magic, nodemap_magic, sizeof(nodemap_magic)) != 0 || le32toh(m_hdr->version) != nodemap_version ||
+	    le32toh(m_hdr->record_size) != sizeof(nodemap_record)) {
+		close();
+		return build_error("open: Not a nodemap of version 1.", -1);
+	}
+
+	// no multiplication may wrap, for sizes that fit the file
+	if (noff % 8 || eoff % 8 || noff > m_len || eoff > m_len || nodes > (m_len - noff)/sizeof(nodemap_record) ||
+	    nedges > (m_len - eoff)/sizeof(uint32_t) || nodes > node_table::npos) {
+		close();
+		return build_error("open: Sections out of bounds.", -1);
+	}
+
+	m_nodes = reinterpret_cast<const nodemap_record *>(m_map + noff);
+	m_edges = reinterpret_cast<const uint32_t *>(m_map + eoff);
+
+	madvise(map, m_len, MADV_SEQUENTIAL);
+
+	// check once, so the indexes can be followed without checks later
+	for (uint64_t i = 0; i < nodes; ++i) {
+		uint64_t first = le64toh(m_nodes[i].edges), n = le32toh(m_nodes[i].nedges);
+		if (first > nedges || n > nedges - first) {
+			close();
+			return build_error("open: Node with edges out of bounds.", -1);
+		}
+	}
+	for (uint64_t i = 0; i < nedges; ++i) {
+		if (le32toh(m_edges[i]) >= nodes) {
+			close();
+			return build_error("open: Edge to unknown node.", -1);
+		}
+	}
+
+	return 0;
+}
+
+
+void nodemap::close()
+{
+	if (m_map)
+		munmap(const_cast<char *>(m_map), m_len);
+
+	m_map = nullptr;
+	m_len = 0;
+	m_hdr = nullptr;
+	m_nodes = nullptr;
+	m_edges = nullptr;
+}
+
+
+int nodemap::write_text(const string &path)
+{
+	FILE *f = fopen(path.c_str(), "w");
+	if (!f)
+		return build_error("write_text:", -1);
+
+	string line = "";
+	uint32_t n = 0;
+
+	for (uint64_t i = 0; i < size(); ++i) {
+		const nodemap_record &rec = at(i);
+		uint16_t scans = le16toh(rec.scans);
+		if (scans == 0)
+			continue;
+
+		line = rec.addr.str();
+		const uint32_t *e = edges_of(i, n);
+		for (uint32_t j = 0; j < n; ++j) {
+			line += ",";
+			line += at(le32toh(e[j])).addr.str();
+		}
+		line += "\n";
+
+		// one line per connect, as the handled count is restored from that
+		for (uint16_t j = 1; j < scans; ++j)
+			line += rec.addr.str() + "\n";
+
+		if (fwrite(line.c_str(), line.size(), 1, f) != 1) {
+			fclose(f);
+			return build_error("write_text: fwrite", -1);
+		}
+	}
+
+	if (fclose(f) != 0)
+		return build_error("write_text: fclose", -1);
+	return 0;
+}
+
+
+uint32_t nodemap_builder::add(const node_addr &node)
+{
+	uint32_t idx = m_nodes.insert(node, node.hash());
+
+	if (idx == m_records.size()) {
+		nodemap_record rec{};
+		rec.addr = node;
+		m_records.push_back(rec);
+	}
+
+	return idx;
+}
+
+
+int nodemap_builder::read_text(const string &path)
+{
+	FILE *f = fopen(path.c_str(), "r");
+	if (!f)
+		return build_error("read_text:", -1);
+
+	char *buf = nullptr;
+	size_t blen = 0;
+	ssize_t r = 0;
+	uint32_t version = 0;
+	node_addr node;
+	vector<node_addr> addrs;
+
+	while ((r = getline(&buf, &blen, f)) > 0) {
+		if (parse_nodemap_line(buf, r, node, version, addrs) < 0)
+			continue;
+
+		uint32_t from = add(node);
+		nodemap_record &rec = m_records[from];
+		if (rec.scans < 0xffff)
+			++rec.scans;
+		if (version)
+			rec.version = version;
+
+		for (const auto &a : addrs)
+			add_edge(from, add(a));
+	}
+
+	free(buf);
+	fclose(f);
+	return 0;
+}
+
+
+int nodemap_builder::write(const string &path)
+{
+	sort(m_edges.begin(), m_edges.end());
+	m_edges.erase(unique(m_edges.begin(), m_edges.end()), m_edges.end());
+
+	for (auto &rec : m_records) {
+		rec.edges = 0;
+		rec.nedges = 0;
+	}
+	for (uint64_t i = m_edges.size(); i > 0; --i) {
+		nodemap_record &rec = m_records[m_edges[i - 1]>>32];
+		rec.edges = i - 1;
+		++rec.nedges;
+	}
+
+	nodemap_header hdr{};
+	memcpy(hdr.magic, nodemap_magic, sizeof(hdr.magic));
+	hdr.version = htole32(nodemap_version);
+	hdr.record_size = htole32(sizeof(nodemap_record));
+	hdr.nodes = htole64(m_records.size());
+	hdr.edges = htole64(m_edges.size());
+	hdr.nodes_off = htole64(sizeof(hdr));
+	hdr.edges_off = htole64(sizeof(hdr) + m_records.size()*sizeof(nodemap_record));
+
+	FILE *f = fopen(path.c_str(), "w");
+	if (!f)
+		return build_error("write:", -1);
+
+	bool ok = fwrite(&hdr, sizeof(hdr), 1, f) == 1;
+
+	for (size_t i = 0; ok && i < m_records.size(); ++i) {
+		nodemap_record rec = m_records[i];
+		rec.scans = htole16(rec.scans);
+		rec.version = htole32(rec.version);
+		rec.services = htole64(rec.services);
+		rec.first_seen = htole32(rec.first_seen);
+		rec.last_seen = htole32(rec.last_seen);
+		rec.edges = htole64(rec.edges);
+		rec.nedges = htole32(rec.nedges);
+		ok = fwrite(&rec, sizeof(rec), 1, f) == 1;
+	}
+
+	for (size_t i = 0; ok && i < m_edges.size(); ++i) {
+		uint32_t to = htole32(m_edges[i] & 0xffffffff);
+		ok = fwrite(&to, sizeof(to), 1, f) == 1;
+	}
+
+	if (fclose(f) != 0 || !ok)
+		return build_error("write:", -1);
+	return 0;
+}
+
+
+}
+
@@ -0,0 +1,221 @@
+/*
+ * This file is part of the hoschi p2p scan engine.
+ *
+ * (C) 2019 by Sebastian Krahmer,
+ *             sebastian [dot] krahmer [at] gmail [dot] com
+ *
+ * hoschi is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * hoschi is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with hoschi. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef hoschi_nodemap_h
+#define hoschi_nodemap_h
+
+#include <string>
+#include <vector>
+#include <cerrno>
+#include <cstring>
+#include <cstdint>
+#include <cstddef>
+#include <endian.h>
+#include "node-addr.h"
+#include "node-table.h"
+
+
+namespace hoschi {
+
+
+// Binary nodemap, version 1. A header, a table of fixed size node records and
+// the adjacency section, which holds for each node the indexes of the nodes
+// it advertised. The nodes of record i are edges[rec.edges .. rec.edges + rec.nedges).
+// All integers are little endian and all sections 8 byte aligned, so the file
+// can be mmap'ed and used as it is.
+struct nodemap_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t record_size;
+	uint64_t nodes;
+	uint64_t edges;
+	uint64_t nodes_off, edges_off;
+} __attribute__((packed));
+
+
+struct nodemap_record {
+	node_addr addr;
+	uint16_t scans;			// how often we talked to it, 0 if only advertised
+	uint32_t version;		// protocol version, 0 if unknown
+	uint64_t services;
+	uint32_t first_seen, last_seen;	// unix time, 0 if unknown
+	uint64_t edges;			// index of its first advertised node in edge section
+	uint32_t nedges;
+	uint32_t reserved;
+} __attribute__((packed));
+
+
+// Read-only view on a binary nodemap. The file is mmap'ed, nothing is copied.
+class nodemap {
+
+	std::string m_err{""};
+
+	const char *m_map{nullptr};
+	size_t m_len{0};
+
+	const nodemap_header *m_hdr{nullptr};
+	const nodemap_record *m_nodes{nullptr};
+	const uint32_t *m_edges{nullptr};
+
+	template<class T>
+	T build_error(const std::string &msg, T r)
+	{
+		m_err = "nodemap::";
+		m_err += msg;
+
+		if (errno) {
+			m_err += ":";
+			m_err += strerror(errno);
+		}
+		errno = 0;
+		return r;
+	}
+
+public:
+
+	nodemap()
+	{
+	}
+
+	virtual ~nodemap()
+	{
+		close();
+	}
+
+	nodemap(const nodemap &) = delete;
+
+	nodemap &operator=(const nodemap &) = delete;
+
+	// whether the file is a binary nodemap, judging by its magic
+	static bool probe(const std::string &);
+
+	int open(const std::string &);
+
+	void close();
+
+	uint64_t size()
+	{
+		return m_hdr ? le64toh(m_hdr->nodes) : 0;
+	}
+
+	uint64_t edges()
+	{
+		return m_hdr ? le64toh(m_hdr->edges) : 0;
+	}
+
+	const nodemap_record &at(uint64_t idx)
+	{
+		return m_nodes[idx];
+	}
+
+	// the i-th entry of the edge section
+	uint32_t edge(uint64_t i)
+	{
+		return m_edges[i];
+	}
+
+	// the nodes advertised by node idx, as indexes into the node table
+	const uint32_t *edges_of(uint64_t idx, uint32_t &n)
+	{
+		n = le32toh(m_nodes[idx].nedges);
+		return m_edges + le64toh(m_nodes[idx].edges);
+	}
+
+	// write it back in text form, as addr_filter::dump() does
+	int write_text(const std::string &);
+
+	const char *why()
+	{
+		return m_err.c_str();
+	}
+};
+
+
+// Collects nodes and who advertised whom, and writes a binary nodemap.
+class nodemap_builder {
+
+	std::string m_err{""};
+
+	node_table m_nodes;
+
+	// in host order until written
+	std::vector<nodemap_record> m_records;
+
+	// (from << 32)|to, sorted and made unique when written
+	std::vector<uint64_t> m_edges;
+
+	template<class T>
+	T build_error(const std::string &msg, T r)
+	{
+		m_err = "nodemap_builder::";
+		m_err += msg;
+
+		if (errno) {
+			m_err += ":";
+			m_err += strerror(errno);
+		}
+		errno = 0;
+		return r;
+	}
+
+public:
+
+	nodemap_builder()
+	{
+	}
+
+	virtual ~nodemap_builder()
+	{
+	}
+
+	// index of node, adding it if not yet known
+	uint32_t add(const node_addr &);
+
+	nodemap_record &at(uint32_t idx)
+	{
+		return m_records[idx];
+	}
+
+	void add_edge(uint32_t from, uint32_t to)
+	{
+		m_edges.push_back((uint64_t(from)<<32)|to);
+	}
+
+	// add what a text nodemap contains
+	int read_text(const std::string &);
+
+	int write(const std::string &);
+
+	const char *why()
+	{
+		return m_err.c_str();
+	}
+};
+
+
+// Split a line of a text nodemap: the node we talked to, its version if the
+// line has one and the nodes it advertised. -1 if there's no valid node in front.
+int parse_nodemap_line(const char *, size_t, node_addr &, uint32_t &, std::vector<node_addr> &);
+
+
+}
+
+#endif
+
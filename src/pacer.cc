@@ -0,0 +1,148 @@
+/*
+ * This file is part of the hoschi p2p scan engine.
+ *
+ * (C) 2019 by Sebastian Krahmer,
+ *             sebastian [dot] krahmer [at] gmail [dot] com
+ *
+ * hoschi is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * hoschi is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with hoschi. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cstdint>
+#include "pacer.h"
+#include "misc.h"
+
+
+namespace hoschi {
+
+
+void token_bucket::init(double rate, double burst, uint64_t now)
+{
+	m_rate = rate;
+	m_burst = burst < 1 ? 1 : burst;
+	m_tokens = 1;
+	m_last = now;
+}
+
+
+void token_bucket::refill(uint64_t now)
+{
+	if (now <= m_last)
+		return;
+
+	m_tokens += (now - m_last)*m_rate/1000;
+	if (m_tokens > m_burst)
+		m_tokens = m_burst;
+	m_last = now;
+}
+
+
+uint32_t token_bucket::available(uint32_t max)
+{
+	if (m_rate <= 0 || m_tokens >= max)
+		return max;
+	return uint32_t(m_tokens);
+}
+
+
+bool token_bucket::take()
+{
+	if (m_rate <= 0)
+		return 1;
+	if (m_tokens < 1)
+		return 0;
+	m_tokens -= 1;
+	return 1;
+}
+
+
+int token_bucket::next_token(int max)
+{
+	if (m_rate <= 0 || m_tokens >= 1)
+		return 0;
+
+	// round up, so we don't wake up a fraction too early for nothing
+	double ms = (1 - m_tokens)*1000/m_rate + 1;
+	if (ms >= max)
+		return max;
+	return int(ms);
+}
+
+
+void aimd_controller::init(double min_rate, double max_rate, double rate, uint32_t min_conns, uint32_t max_conns, uint64_t now)
+{
+	m_min_rate = min_rate > 0 ? min_rate : 1;
+	m_max_rate = max_rate > m_min_rate ? max_rate : m_min_rate;
+	m_min_conns = min_conns > 0 ? min_conns : 1;
+	m_max_conns = max_conns > m_min_conns ? max_conns : m_min_conns;
+
+	// start with the given rate if it fits, and at the low end for the ceiling
+	m_rate = rate;
+	if (m_rate < m_min_rate || m_rate > m_max_rate)
+		m_rate = m_min_rate;
+	m_conns = m_min_conns;
+
+	m_window_start = now;
+}
+
+
+bool aimd_controller::update(uint64_t now)
+{
+	if (now - m_window_start < numbers::aimd_window)
+		return 0;
+	m_window_start = now;
+
+	uint32_t total = m_ok + m_failed;
+
+	// too few samples to tell anything
+	if (total < numbers::aimd_min_samples)
+		return 0;
+
+	m_ratio = double(m_failed)/total;
+	m_ok = m_failed = 0;
+
+	double rate = m_rate;
+	uint32_t conns = m_conns;
+
+	if (m_baseline >= 0 && m_ratio > m_baseline + numbers::aimd_margin/100.0) {
+		rate *= numbers::aimd_decrease/100.0;
+		conns = conns*numbers::aimd_decrease/100;
+	} else {
+		rate += numbers::aimd_rate_step;
+		conns += numbers::aimd_conns_step;
+
+		// only learn the normal failure ratio from windows without loss
+		if (m_baseline < 0)
+			m_baseline = m_ratio;
+		else
+			m_baseline = 0.9*m_baseline + 0.1*m_ratio;
+	}
+
+	if (rate < m_min_rate)
+		rate = m_min_rate;
+	if (rate > m_max_rate)
+		rate = m_max_rate;
+	if (conns < m_min_conns)
+		conns = m_min_conns;
+	if (conns > m_max_conns)
+		conns = m_max_conns;
+
+	bool changed = (rate != m_rate || conns != m_conns);
+	m_rate = rate;
+	m_conns = conns;
+	return changed;
+}
+
+
+}
+
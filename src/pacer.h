@@ -0,0 +1,136 @@
+/*
+ * This file is part of the hoschi p2p scan engine.
+ *
+ * (C) 2019 by Sebastian Krahmer,
+ *             sebastian [dot] krahmer [at] gmail [dot] com
+ *
+ * hoschi is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * hoschi is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with hoschi. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef hoschi_pacer_h
+#define hoschi_pacer_h
+
+#include <cstdint>
+
+
+namespace hoschi {
+
+
+// Token bucket that paces the connects, since a lot of cable modems loose
+// packets if you connect too fast. Tokens refill with 'rate' per second up
+// to 'burst'. A rate of 0 means no pacing at all.
+class token_bucket {
+
+	double m_rate{0}, m_burst{1}, m_tokens{0};
+
+	uint64_t m_last{0};
+
+public:
+
+	token_bucket()
+	{
+	}
+
+	virtual ~token_bucket()
+	{
+	}
+
+	void init(double, double, uint64_t);
+
+	// add tokens for the milliseconds passed since last refill
+	void refill(uint64_t);
+
+	uint32_t available(uint32_t);
+
+	bool take();
+
+	// milliseconds until next token, but not more than the given max
+	int next_token(int);
+
+	double rate()
+	{
+		return m_rate;
+	}
+
+	void rate(double r)
+	{
+		m_rate = r;
+	}
+};
+
+
+// Adapts connect rate and concurrency ceiling AIMD-style. Once per window,
+// the ratio of failed connects (errors, timeouts, poll errors) to all outcomes
+// is compared to its long term average. As most advertised addresses are dead
+// anyway, only a failure ratio clearly above that average is taken as a sign of
+// packet loss on the uplink, and both are cut multiplicatively. Otherwise they
+// are raised additively, within the bounds.
+class aimd_controller {
+
+	double m_min_rate{1}, m_max_rate{1000}, m_rate{66};
+	uint32_t m_min_conns{64}, m_max_conns{60000}, m_conns{1024};
+
+	uint32_t m_ok{0}, m_failed{0};
+
+	// long term failure ratio, -1 if not known yet
+	double m_baseline{-1}, m_ratio{0};
+
+	uint64_t m_window_start{0};
+
+public:
+
+	aimd_controller()
+	{
+	}
+
+	virtual ~aimd_controller()
+	{
+	}
+
+	void init(double, double, double, uint32_t, uint32_t, uint64_t);
+
+	void success()
+	{
+		++m_ok;
+	}
+
+	void failure()
+	{
+		++m_failed;
+	}
+
+	// evaluate window if it is over; true if rate or ceiling changed
+	bool update(uint64_t);
+
+	double rate()
+	{
+		return m_rate;
+	}
+
+	uint32_t conns()
+	{
+		return m_conns;
+	}
+
+	double ratio()
+	{
+		return m_ratio;
+	}
+};
+
+
+}
+
+#endif
+
@@ -0,0 +1,112 @@
+/*
+ * This file is part of the hoschi p2p scan engine.
+ *
+ * (C) 2019 by Sebastian Krahmer,
+ *             sebastian [dot] krahmer [at] gmail [dot] com
+ *
+ * hoschi is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * hoschi is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with hoschi. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef hoschi_pool_h
+#define hoschi_pool_h
+
+#include <new>
+#include <vector>
+#include <memory>
+#include <cstddef>
+#include "misc.h"
+
+
+namespace hoschi {
+
+
+// Fixed capacity pool of T's, allocated in slabs of numbers::slab_size
+// objects and recycled in place. Objects are only constructed once, so
+// whatever they allocated themselves stays around for the next user and
+// there is no heap traffic once the pool is warm. Objects are handed out
+// as they are, the user has to reset them. Not thread safe.
+template<class T>
+class slab_pool {
+
+	std::vector<std::unique_ptr<T[]>> m_slabs;
+
+	std::vector<T *> m_free;
+
+	size_t m_capacity{0}, m_in_use{0}, m_peak{0};
+
+public:
+
+	struct stats {
+		size_t capacity{0}, allocated{0}, in_use{0}, peak{0};
+	};
+
+	slab_pool()
+	{
+	}
+
+	virtual ~slab_pool()
+	{
+	}
+
+	void init(size_t capacity)
+	{
+		m_capacity = capacity;
+		m_free.reserve(capacity < numbers::slab_size ? numbers::slab_size : capacity);
+	}
+
+	// nullptr if OOM or capacity is exhausted
+	T *get()
+	{
+		if (m_free.empty()) {
+			if (m_slabs.size()*numbers::slab_size >= m_capacity)
+				return nullptr;
+
+			std::unique_ptr<T[]> slab(new (std::nothrow) T[numbers::slab_size]);
+			if (!slab.get())
+				return nullptr;
+			for (size_t i = numbers::slab_size; i > 0; --i)
+				m_free.push_back(&slab[i - 1]);
+			m_slabs.push_back(std::move(slab));
+		}
+
+		T *t = m_free.back();
+		m_free.pop_back();
+
+		if (++m_in_use > m_peak)
+			m_peak = m_in_use;
+		return t;
+	}
+
+	void put(T *t)
+	{
+		m_free.push_back(t);
+		--m_in_use;
+	}
+
+	stats occupancy()
+	{
+		stats s;
+		s.capacity = m_capacity;
+		s.allocated = m_slabs.size()*numbers::slab_size;
+		s.in_use = m_in_use;
+		s.peak = m_peak;
+		return s;
+	}
+};
+
+
+}
+
+#endif
+
@@ -19,6 +19,8 @@
  */
 
 #include <string>
+#include <random>
+#include <cstddef>
 #include <stdint.h>
 #include <arpa/inet.h>
 
@@ -27,6 +29,7 @@
 #include "protocol.h"
 #include "global.h"
 #include "misc.h"
+#include "config.h"
 
 extern "C" {
 #include <openssl/evp.h>
@@ -45,10 +48,16 @@ uint32_t btc_header::m_expected_magic{htobtc32(numbers::testnet3)};
 
 int btc_header::parse(const string &pkt)
 {
-	if (pkt.size() < sizeof(m_header))
+	return parse(pkt.c_str(), pkt.size());
+}
+
+
+int btc_header::parse(const char *pkt, size_t len)
+{
+	if (len < sizeof(m_header))
 		return build_error("parse: Header too short", -1);
 
-	memcpy(&m_header, pkt.c_str(), sizeof(m_header));
+	memcpy(&m_header, pkt, sizeof(m_header));
 	if (btctoh32(m_header.magic) != m_expected_magic)
 		return build_error("parse: Invalid header magic", -1);
 	if (btctoh32(m_header.paylen) > numbers::max_paylen)
@@ -59,166 +68,140 @@ int btc_header::parse(const string &pkt)
 }
 
 
-uint32_t btc_header::checksum(const string &payload)
+// first 4 bytes of SHA256(SHA256(data)) as found in the header, in wire order.
+// Each thread keeps its hash context, so there is no alloc/free per msg.
+int sha256d_checksum(const void *data, size_t len, uint32_t &csum)
 {
-	unsigned int hlen = payload.size();
+	static thread_local free_ptr<EVP_MD_CTX> md_ctx(EVP_MD_CTX_create(), EVP_MD_CTX_delete);
+
+	unsigned int hlen = 0;
 	unsigned char digest[32] = {0}, digest2[32] = {0}, *dptr = digest;
-	const void *ptr = payload.c_str();
+	const void *ptr = data;
 
-	free_ptr<EVP_MD_CTX> md_ctx(EVP_MD_CTX_create(), EVP_MD_CTX_delete);
 	if (!md_ctx.get())
-		return 0;
+		return -1;
 	for (int i = 0; i < 2; ++i) {
 		if (EVP_DigestInit_ex(md_ctx.get(), EVP_sha256(), nullptr) != 1)
 			return -1;
-		if (EVP_DigestUpdate(md_ctx.get(), ptr, hlen) != 1)
+		if (EVP_DigestUpdate(md_ctx.get(), ptr, len) != 1)
 			return -1;
 		if (EVP_DigestFinal_ex(md_ctx.get(), dptr, &hlen) != 1)
 			return -1;
 		ptr = digest;
+		len = hlen;
 		dptr = digest2;
 	}
 
-	m_header.checksum = htobtc32(*reinterpret_cast<uint32_t *>(dptr));
-	m_header.paylen = htobtc32(payload.size());
-	return m_header.checksum;
+	memcpy(&csum, digest2, sizeof(csum));
+	return 0;
 }
 
 
-static bool is_valid_ip(const char *ip)
+uint32_t btc_header::checksum(const string &payload)
 {
-	// OK, maybe in 2000 i wouldn't have done the validity check
-	// with strings but with netmasks, but I think its fast enough,
-	// as the bottleneck isn't in our program anyway (but in the net and remote peers).
-	// the IP address string was obtained via inet_ntop() so its canonicalized
-	// and can't be "010.1.2.03" or similar.
-	// Also, the worst case is that we may try to connect to an private IP, which
-	// may be annoying but not risky anyway.
-
-	// IPv4 mapped IPv6 addresses
-	if (strstr(ip, "::ffff:") == ip || (strstr(ip, ":") && strstr(ip, ".")))
-		return 0;
+	uint32_t csum = 0;
+	sha256d_checksum(payload.c_str(), payload.size(), csum);
 
-	if (strstr(ip, "10.") == ip)
-		return 0;
-	if (strstr(ip, "192.168.") == ip)
-		return 0;
-
-	if (strstr(ip, "172.16.") == ip)
-		return 0;
-	if (strstr(ip, "172.17.") == ip)
-		return 0;
-	if (strstr(ip, "172.18.") == ip)
-		return 0;
-	if (strstr(ip, "172.19.") == ip)
-		return 0;
-
-	// 172.20.x.y - 172.29.x.y
-	if (strstr(ip, "172.2") == ip && ip[6] == '.')
-		return 0;
-
-	if (strstr(ip, "172.30.") == ip)
-		return 0;
-	if (strstr(ip, "172.31.") == ip)
-		return 0;
+	m_header.checksum = csum;
+	m_header.paylen = htobtc32(payload.size());
+	return m_header.checksum;
+}
 
-	if (strstr(ip, "127.") == ip)
-		return 0;
 
-	// LAN multicast
-	if (strstr(ip, "224.0.0.") == ip)
-		return 0;
+int btc_header::verify(const char *pkt, size_t len)
+{
+	size_t n = btctoh32(m_header.paylen);
+	if (len < sizeof(m_header) + n)
+		return build_error("verify: Message too short", -1);
 
-	if (strstr(ip, "fc00:") == ip)
-		return 0;
-	if (strstr(ip, "fd00:") == ip)
-		return 0;
-	if (strstr(ip, "fe80:") == ip)
-		return 0;
-	if (strcmp(ip, "::1") == 0 || strcmp(ip, "::") == 0)
-		return 0;
+	uint32_t csum = 0;
+	if (sha256d_checksum(pkt + sizeof(m_header), n, csum) < 0)
+		return build_error("verify: Unable to hash payload", -1);
+	if (csum != m_header.checksum)
+		return build_error("verify: Checksum mismatch", -1);
 
-	return 1;
+	return 0;
 }
 
 
-static bool is_valid_port(uint16_t p)
+// set paylen and checksum of a complete msg in place
+static void seal(string &msg)
 {
-	return p > 1024;
-}
+	auto *hdr = reinterpret_cast<btc_header::header *>(&msg[0]);
+	size_t n = msg.size() - sizeof(*hdr);
 
+	uint32_t csum = 0;
+	sha256d_checksum(msg.c_str() + sizeof(*hdr), n, csum);
 
-int parse_netaddr(const string &s, string &node)
-{
-	int r = AF_INET6;
-
-	if (s.size() < sizeof(net_addr))
-		return -1;
+	hdr->paylen = htobtc32(n);
+	hdr->checksum = csum;
+}
 
-	const auto *na = reinterpret_cast<const net_addr *>(s.c_str());
 
-	char dst[256] = {0};
-	if (!inet_ntop(AF_INET6, na->addr_bytes, dst, sizeof(dst) - 1))
-		return -1;
-	// IPv4 mapped IPv6 address?
-	if (string(dst).find("::ffff:") == 0) {
-		if (!inet_ntop(AF_INET, na->addr_bytes + 12, dst, sizeof(dst) - 1))
-			return -1;
-		r = AF_INET;
+// Checks on the binary address, so that nothing needs to be formatted
+// for nodes that we throw away anyway. The worst case is that we may try
+// to connect to a private IP, which may be annoying but not risky anyway.
+static bool is_valid_ip(const node_addr &na)
+{
+	const uint8_t *ip = na.ip;
+
+	if (na.is_v4()) {
+		ip += 12;
+
+		if (ip[0] == 10 || ip[0] == 127)
+			return 0;
+		if (ip[0] == 192 && ip[1] == 168)
+			return 0;
+		// 172.16.x.y - 172.31.x.y
+		if (ip[0] == 172 && (ip[1] & 0xf0) == 16)
+			return 0;
+		// LAN multicast
+		if (ip[0] == 224 && ip[1] == 0 && ip[2] == 0)
+			return 0;
+
+		return 1;
 	}
 
-	if (is_valid_ip(dst) != 1 || is_valid_port(ntohs(na->port)) != 1)
-		return -1;
+	// ::, ::1 and IPv4 compatible addresses
+	static const uint8_t zero[12] = {0};
+	if (memcmp(ip, zero, sizeof(zero)) == 0)
+		return 0;
 
-	node = "[";
-	node += dst;
-	char tmp[32] = {0};
-	snprintf(tmp, sizeof(tmp) - 1, "]:%hu", ntohs(na->port));
-	node += tmp;
-	return r;
+	uint16_t prefix = (ip[0]<<8)|ip[1];
+	if (prefix == 0xfc00 || prefix == 0xfd00 || prefix == 0xfe80)
+		return 0;
+
+	return 1;
 }
 
 
-int parse_netaddr_version(const string &s, string &node)
+static bool is_valid_port(uint16_t p)
 {
-	// a netaddr inside version packet is just missing 4 bytes at the beginning,
-	// so prepend some nonsense and call orig function
-	return parse_netaddr("1234" + s , node);
+	return p > 1024;
 }
 
 
-int make_netaddr_version(const string &node, net_addr_version &na)
+// na points to the part of a net_addr following the time field, which is
+// what a net_addr_version looks like
+int parse_netaddr(const net_addr_version *na, node_addr &node)
 {
-	string::size_type idx = 0;
+	memcpy(node.ip, na->addr_bytes, sizeof(node.ip));
+	node.port = na->port;
 
-	if (node.find("[") != 0)
-		return -1;
-	if ((idx = node.find("]:")) == string::npos)
-		return -1;
-	string ip = node.substr(1, idx - 1);
-	uint16_t port = 0;
-	if (sscanf(node.c_str() + idx + 2, "%hu", &port) != 1)
+	if ((!config::allow_private && is_valid_ip(node) != 1) || is_valid_port(ntohs(node.port)) != 1)
 		return -1;
 
-	if (ip.find(":") == string::npos) {
-		ip = "::ffff:" + ip;
-	}
-	inet_pton(AF_INET6, ip.c_str(), na.addr_bytes);
-	na.port = htons(port);
-	return 0;
+	return node.family();
 }
 
 
-string make_version(const string &node)
+// the parts of a version msg that are the same for every node
+static string make_version_template()
 {
 	btc_header hdr("version");
 
 	btc_messages::version vers;
-	vers.timestamp = htobtc64(time(nullptr));
 	vers.services = htobtc64(numbers::node_network|numbers::node_witness);		// fake it
-//	vers.nonce = 0x373723527393;
-
-	make_netaddr_version(node, vers.addr_recv);
 
 	string payload = string(reinterpret_cast<char *>(&vers), sizeof(vers));
 	payload += make_valstring(global::client_name);
@@ -236,30 +219,54 @@ string make_version(const string &node)
 }
 
 
+// Copy the prebuilt template and only patch what differs per node,
+// so just the checksum has to be computed again.
+string make_version(const node_addr &node)
+{
+	static const string tmpl = make_version_template();
+	static thread_local mt19937_64 rnd{random_device{}()};
+
+	string msg = tmpl;
+	auto *vers = reinterpret_cast<btc_messages::version *>(&msg[sizeof(btc_header::header)]);
+
+	vers->timestamp = htobtc64(time(nullptr));
+	vers->nonce = rnd();
+	memcpy(vers->addr_recv.addr_bytes, node.ip, sizeof(node.ip));
+	vers->addr_recv.port = node.port;
+
+	seal(msg);
+	return msg;
+}
+
+
+// verack and getaddr have no payload, so they never change
 string make_verack()
 {
-	btc_header hdr("verack");
-	hdr.checksum("");
+	static const string verack = btc_header("verack").header_string();
+	static const string msg = [] { string m = verack; seal(m); return m; }();
 
-	return hdr.header_string();
+	return msg;
 }
 
 
-string make_pong(const string &payload)
+string make_pong(const char *payload, size_t len)
 {
-	btc_header hdr("pong");
-	hdr.checksum(payload);
+	static const string pong = btc_header("pong").header_string();
 
-	return hdr.header_string() + payload;
+	string msg = pong;
+	msg.append(payload, len);
+	seal(msg);
+
+	return msg;
 }
 
 
 string make_getaddr()
 {
-	btc_header hdr("getaddr");
-	hdr.checksum("");
+	static const string getaddr = btc_header("getaddr").header_string();
+	static const string msg = [] { string m = getaddr; seal(m); return m; }();
 
-	return hdr.header_string();
+	return msg;
 }
 
 
@@ -25,6 +25,7 @@
 #include <stdint.h>
 #include <cstring>
 #include <cerrno>
+#include "node-addr.h"
 #include "misc.h"
 
 
@@ -117,6 +118,11 @@ public:
 
 	int parse(const std::string &);
 
+	int parse(const char *, size_t);
+
+	// check payload of a complete msg against the checksum of the parsed header
+	int verify(const char *, size_t);
+
 	const char *why()
 	{
 		return m_err.c_str();
@@ -157,11 +163,13 @@ struct version {
 }	// btc_messages namespace
 
 
-std::string make_version(const std::string &);
+int sha256d_checksum(const void *, size_t, uint32_t &);
+
+std::string make_version(const node_addr &);
 
 std::string make_verack();
 
-std::string make_pong(const std::string &);
+std::string make_pong(const char *, size_t);
 
 std::string make_getaddr();
 
@@ -171,9 +179,7 @@ std::string make_valint(uint32_t);
 
 std::string make_valstring(const std::string &);
 
-int parse_netaddr(const std::string &, std::string &);
-
-int parse_netaddr_version(const std::string &, std::string &);
+int parse_netaddr(const btc_messages::net_addr_version *, node_addr &);
 
 
 }	// hoschi namespace
@@ -0,0 +1,532 @@
+/*
+ * This file is part of the hoschi p2p scan engine.
+ *
+ * (C) 2019 by Sebastian Krahmer,
+ *             sebastian [dot] krahmer [at] gmail [dot] com
+ *
+ * hoschi is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * hoschi is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with hoschi. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string>
+#include <vector>
+#include <new>
+#include <cstring>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/epoll.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#include "reactor.h"
+#include "misc.h"
+
+
+using namespace std;
+
+
+namespace hoschi {
+
+
+int poll_reactor::init(int max_fds)
+{
+	if ((m_pfds = new (nothrow) pollfd[max_fds]) == nullptr)
+		return build_error("init::new: OOM", -1);
+	memset(m_pfds, 0, sizeof(struct pollfd) * max_fds);
+	for (int i = 0; i < max_fds; ++i)
+		m_pfds[i].fd = -1;
+
+	m_nfds = max_fds;
+	return 0;
+}
+
+
+int poll_reactor::add(int fd, int events)
+{
+	if (fd < 0 || fd >= m_nfds)
+		return build_error("add: Invalid fd.", -1);
+
+	if (m_first_fd == 0 || fd < m_first_fd)
+		m_first_fd = fd;
+	if (fd > m_max_fd)
+		m_max_fd = fd;
+
+	m_pfds[fd].fd = fd;
+	m_pfds[fd].events = events;
+	m_pfds[fd].revents = 0;
+	return 0;
+}
+
+
+int poll_reactor::mod(int fd, int events)
+{
+	if (fd < 0 || fd >= m_nfds)
+		return build_error("mod: Invalid fd.", -1);
+
+	m_pfds[fd].events = events;
+	return 0;
+}
+
+
+int poll_reactor::del(int fd)
+{
+	if (fd < 0 || fd >= m_nfds)
+		return build_error("del: Invalid fd.", -1);
+
+	m_pfds[fd].fd = -1;
+	m_pfds[fd].events = m_pfds[fd].revents = 0;
+
+	// shrink poll range if the highest fd went away
+	if (fd == m_max_fd) {
+		for (; m_max_fd >= m_first_fd && m_pfds[m_max_fd].fd == -1; --m_max_fd)
+			;
+	}
+	return 0;
+}
+
+
+int poll_reactor::wait(vector<event> &ready, int timeout)
+{
+	ready.clear();
+
+	int r = 0;
+	if ((r = poll(m_pfds, m_max_fd + 1, timeout)) < 0)
+		return build_error("wait::poll:", -1);
+
+	event ev;
+	for (int i = m_first_fd; i <= m_max_fd && r > 0; ++i) {
+		if (m_pfds[i].fd == -1 || m_pfds[i].revents == 0)
+			continue;
+		ev.fd = i;
+		ev.events = m_pfds[i].revents;
+		m_pfds[i].revents = 0;
+		ready.push_back(ev);
+		--r;
+	}
+
+	return ready.size();
+}
+
+
+epoll_reactor::~epoll_reactor()
+{
+	if (m_epfd >= 0)
+		close(m_epfd);
+	delete [] m_events;
+}
+
+
+int epoll_reactor::init(int max_fds)
+{
+	if ((m_epfd = epoll_create1(EPOLL_CLOEXEC)) < 0)
+		return build_error("init::epoll_create1:", -1);
+
+	if ((m_events = new (nothrow) epoll_event[numbers::max_events]) == nullptr)
+		return build_error("init::new: OOM", -1);
+
+	m_nfds = max_fds;
+	return 0;
+}
+
+
+int epoll_reactor::add(int fd, int events)
+{
+	if (fd < 0 || fd >= m_nfds)
+		return build_error("add: Invalid fd.", -1);
+
+	// Register for both directions once and for all. The engine keeps the
+	// per node interest mask itself and filters readiness against it, so
+	// FSM state changes don't need an epoll_ctl() syscall each.
+	epoll_event ev;
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN|EPOLLOUT|EPOLLET;
+	ev.data.fd = fd;
+
+	if (epoll_ctl(m_epfd, EPOLL_CTL_ADD, fd, &ev) < 0)
+		return build_error("add::epoll_ctl:", -1);
+	return 0;
+}
+
+
+int epoll_reactor::mod(int fd, int events)
+{
+	if (fd < 0 || fd >= m_nfds)
+		return build_error("mod: Invalid fd.", -1);
+	return 0;
+}
+
+
+int epoll_reactor::del(int fd)
+{
+	// also removed by kernel on close(), but be explicit
+	epoll_event ev;
+	memset(&ev, 0, sizeof(ev));
+	epoll_ctl(m_epfd, EPOLL_CTL_DEL, fd, &ev);
+	errno = 0;
+	return 0;
+}
+
+
+int epoll_reactor::wait(vector<event> &ready, int timeout)
+{
+	ready.clear();
+
+	int r = 0;
+	if ((r = epoll_wait(m_epfd, m_events, numbers::max_events, timeout)) < 0)
+		return build_error("wait::epoll_wait:", -1);
+
+	event ev;
+	for (int i = 0; i < r; ++i) {
+		ev.fd = m_events[i].data.fd;
+		ev.events = 0;
+		if (m_events[i].events & EPOLLIN)
+			ev.events |= POLLIN;
+		if (m_events[i].events & EPOLLOUT)
+			ev.events |= POLLOUT;
+		if (m_events[i].events & EPOLLERR)
+			ev.events |= POLLERR;
+		if (m_events[i].events & EPOLLHUP)
+			ev.events |= POLLHUP;
+		ready.push_back(ev);
+	}
+
+	return r;
+}
+
+
+namespace {
+
+// user_data of SQE's that are not I/O on an fd
+enum : uint64_t {
+	uring_cancel_tag	= ~1ULL
+};
+
+// ops of the engine; at most one per direction, so connect and write share a bit in in_flight()
+enum : int {
+	uring_connect	= 0,
+	uring_read	= 1,
+	uring_write	= 2
+};
+
+uint64_t uring_op_tag(int fd, int op)
+{
+	return (uint64_t(op)<<32)|uint32_t(fd);
+}
+
+}
+
+
+uring_reactor::~uring_reactor()
+{
+	if (m_sqes)
+		munmap(m_sqes, m_sqes_len);
+	if (m_cq_ring && m_cq_ring != m_sq_ring)
+		munmap(m_cq_ring, m_cq_ring_len);
+	if (m_sq_ring)
+		munmap(m_sq_ring, m_sq_ring_len);
+	if (m_ring_fd >= 0)
+		close(m_ring_fd);
+	delete [] m_ops;
+}
+
+
+int uring_reactor::init(int max_fds)
+{
+	io_uring_params p;
+	memset(&p, 0, sizeof(p));
+
+	// Every socket may have a read and a write outstanding, plus the cancels
+	// of them. The kernel clamps it to its maximum and keeps overflowing
+	// completions on a list of its own.
+	p.flags = IORING_SETUP_CQSIZE|IORING_SETUP_CLAMP;
+	p.cq_entries = 4*max_fds;
+
+	if ((m_ring_fd = syscall(__NR_io_uring_setup, numbers::max_events*4, &p)) < 0)
+		return build_error("init::io_uring_setup:", -1);
+
+	// the wait timeout is passed along with each io_uring_enter() (5.11)
+	if (!(p.features & IORING_FEAT_EXT_ARG))
+		return build_error("init: Kernel lacks IORING_FEAT_EXT_ARG.", -1);
+
+	m_sq_ring_len = p.sq_off.array + p.sq_entries*sizeof(unsigned);
+	m_cq_ring_len = p.cq_off.cqes + p.cq_entries*sizeof(io_uring_cqe);
+
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		if (m_cq_ring_len > m_sq_ring_len)
+			m_sq_ring_len = m_cq_ring_len;
+		m_cq_ring_len = m_sq_ring_len;
+	}
+
+	if ((m_sq_ring = mmap(nullptr, m_sq_ring_len, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, m_ring_fd, IORING_OFF_SQ_RING)) == MAP_FAILED) {
+		m_sq_ring = nullptr;
+		return build_error("init::mmap:", -1);
+	}
+
+	if (p.features & IORING_FEAT_SINGLE_MMAP)
+		m_cq_ring = m_sq_ring;
+	else if ((m_cq_ring = mmap(nullptr, m_cq_ring_len, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, m_ring_fd, IORING_OFF_CQ_RING)) == MAP_FAILED) {
+		m_cq_ring = nullptr;
+		return build_error("init::mmap:", -1);
+	}
+
+	m_sqes_len = p.sq_entries*sizeof(io_uring_sqe);
+	void *sqes = mmap(nullptr, m_sqes_len, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, m_ring_fd, IORING_OFF_SQES);
+	if (sqes == MAP_FAILED)
+		return build_error("init::mmap:", -1);
+	m_sqes = reinterpret_cast<io_uring_sqe *>(sqes);
+
+	char *sq = reinterpret_cast<char *>(m_sq_ring), *cq = reinterpret_cast<char *>(m_cq_ring);
+
+	m_sq_head = reinterpret_cast<unsigned *>(sq + p.sq_off.head);
+	m_sq_tail = reinterpret_cast<unsigned *>(sq + p.sq_off.tail);
+	m_sq_array = reinterpret_cast<unsigned *>(sq + p.sq_off.array);
+	m_sq_mask = *reinterpret_cast<unsigned *>(sq + p.sq_off.ring_mask);
+	m_sq_entries = p.sq_entries;
+
+	m_cq_head = reinterpret_cast<unsigned *>(cq + p.cq_off.head);
+	m_cq_tail = reinterpret_cast<unsigned *>(cq + p.cq_off.tail);
+	m_cq_mask = *reinterpret_cast<unsigned *>(cq + p.cq_off.ring_mask);
+	m_cqes = reinterpret_cast<io_uring_cqe *>(cq + p.cq_off.cqes);
+
+	if ((m_ops = new (nothrow) uint8_t[max_fds]) == nullptr)
+		return build_error("init::new: OOM", -1);
+	memset(m_ops, 0, max_fds);
+
+	m_nfds = max_fds;
+	return 0;
+}
+
+
+// submit and wait for min_complete completions, but no longer than timeout ms
+// if it is >= 0
+int uring_reactor::enter(unsigned to_submit, unsigned min_complete, int timeout)
+{
+	unsigned flags = min_complete ? IORING_ENTER_GETEVENTS : 0;
+
+	// copied by the kernel before io_uring_enter() returns, so no SQE
+	// that outlives this call refers to them
+	__kernel_timespec ts;
+	io_uring_getevents_arg arg;
+	memset(&arg, 0, sizeof(arg));
+
+	if (min_complete && timeout >= 0) {
+		ts.tv_sec = timeout / 1000;
+		ts.tv_nsec = (timeout % 1000) * 1000000;
+		arg.ts = reinterpret_cast<uint64_t>(&ts);
+		flags |= IORING_ENTER_EXT_ARG;
+	}
+
+	int r = 0;
+	if (flags & IORING_ENTER_EXT_ARG)
+		r = syscall(__NR_io_uring_enter, m_ring_fd, to_submit, min_complete, flags, &arg, sizeof(arg));
+	else
+		r = syscall(__NR_io_uring_enter, m_ring_fd, to_submit, min_complete, flags, nullptr, 0);
+	if (r > 0)
+		m_to_submit -= r;
+	return r;
+}
+
+
+io_uring_sqe *uring_reactor::get_sqe()
+{
+	unsigned tail = *m_sq_tail;
+
+	// SQ full? flush what we have so far
+	if (tail - __atomic_load_n(m_sq_head, __ATOMIC_ACQUIRE) >= m_sq_entries) {
+		if (enter(m_to_submit, 0) < 0)
+			return nullptr;
+		if (tail - __atomic_load_n(m_sq_head, __ATOMIC_ACQUIRE) >= m_sq_entries)
+			return nullptr;
+	}
+
+	unsigned idx = tail & m_sq_mask;
+	io_uring_sqe *sqe = &m_sqes[idx];
+	memset(sqe, 0, sizeof(*sqe));
+	m_sq_array[idx] = idx;
+
+	// kernel doesn't look at it before io_uring_enter(), but sqe content must be visible
+	// when it does
+	__atomic_store_n(m_sq_tail, tail + 1, __ATOMIC_RELEASE);
+	++m_to_submit;
+
+	return sqe;
+}
+
+
+// SQE for op on fd, tagged and marked in flight
+io_uring_sqe *uring_reactor::queue_op(int fd, int op)
+{
+	if (fd < 0 || fd >= m_nfds)
+		return build_error("queue_op: Invalid fd.", nullptr);
+	if (m_ops[fd] & (1<<op))
+		return build_error("queue_op: Op already in flight.", nullptr);
+
+	io_uring_sqe *sqe = get_sqe();
+	if (!sqe)
+		return build_error("queue_op: Submission queue full.", nullptr);
+
+	sqe->fd = fd;
+	sqe->user_data = uring_op_tag(fd, op);
+	m_ops[fd] |= (1<<op);
+	return sqe;
+}
+
+
+int uring_reactor::queue_connect(int fd, const sockaddr *sa, socklen_t slen)
+{
+	io_uring_sqe *sqe = queue_op(fd, uring_connect);
+	if (!sqe)
+		return -1;
+
+	sqe->opcode = IORING_OP_CONNECT;
+	sqe->addr = reinterpret_cast<uint64_t>(sa);
+	sqe->off = slen;
+	return 0;
+}
+
+
+int uring_reactor::queue_read(int fd, void *buf, size_t len)
+{
+	io_uring_sqe *sqe = queue_op(fd, uring_read);
+	if (!sqe)
+		return -1;
+
+	sqe->opcode = IORING_OP_RECV;
+	sqe->addr = reinterpret_cast<uint64_t>(buf);
+	sqe->len = len;
+	return 0;
+}
+
+
+int uring_reactor::queue_writev(int fd, const iovec *iov, int n)
+{
+	io_uring_sqe *sqe = queue_op(fd, uring_write);
+	if (!sqe)
+		return -1;
+
+	sqe->opcode = IORING_OP_WRITEV;
+	sqe->addr = reinterpret_cast<uint64_t>(iov);
+	sqe->len = n;
+	return 0;
+}
+
+
+int uring_reactor::in_flight(int fd)
+{
+	if (fd < 0 || fd >= m_nfds)
+		return 0;
+
+	int ev = 0;
+	if (m_ops[fd] & (1<<uring_read))
+		ev |= POLLIN;
+	if (m_ops[fd] & ((1<<uring_connect)|(1<<uring_write)))
+		ev |= POLLOUT;
+	return ev;
+}
+
+
+int uring_reactor::cancel(int fd)
+{
+	if (fd < 0 || fd >= m_nfds)
+		return build_error("cancel: Invalid fd.", -1);
+
+	for (int op = uring_connect; op <= uring_write; ++op) {
+		if (!(m_ops[fd] & (1<<op)))
+			continue;
+		io_uring_sqe *sqe = get_sqe();
+		if (!sqe)
+			return build_error("cancel: Submission queue full.", -1);
+		sqe->opcode = IORING_OP_ASYNC_CANCEL;
+		sqe->fd = -1;
+		sqe->addr = uring_op_tag(fd, op);
+		sqe->user_data = uring_cancel_tag;
+	}
+	return 0;
+}
+
+
+int uring_reactor::add(int fd, int events)
+{
+	if (fd < 0 || fd >= m_nfds)
+		return build_error("add: Invalid fd.", -1);
+	return 0;
+}
+
+
+int uring_reactor::mod(int fd, int events)
+{
+	if (fd < 0 || fd >= m_nfds)
+		return build_error("mod: Invalid fd.", -1);
+	return 0;
+}
+
+
+int uring_reactor::del(int fd)
+{
+	if (fd < 0 || fd >= m_nfds)
+		return build_error("del: Invalid fd.", -1);
+	return 0;
+}
+
+
+int uring_reactor::wait(vector<event> &ready, int timeout)
+{
+	ready.clear();
+
+	// SQE's that are left over after EINTR, EBUSY or a short submit are
+	// submitted with the next wait
+	if (enter(m_to_submit, timeout != 0 ? 1 : 0, timeout) < 0 && errno != EINTR && errno != EBUSY && errno != ETIME)
+		return build_error("wait::io_uring_enter:", -1);
+	errno = 0;
+
+	unsigned head = *m_cq_head, tail = __atomic_load_n(m_cq_tail, __ATOMIC_ACQUIRE);
+
+	event ev;
+	for (; head != tail; ++head) {
+		const io_uring_cqe *cqe = &m_cqes[head & m_cq_mask];
+
+		if (cqe->user_data == uring_cancel_tag)
+			continue;
+
+		int fd = int(cqe->user_data & 0xffffffff), op = int(cqe->user_data>>32);
+		if (fd < 0 || fd >= m_nfds || op > uring_write)
+			continue;
+
+		m_ops[fd] &= ~(1<<op);
+
+		ev.fd = fd;
+		ev.events = (op == uring_read) ? POLLIN : POLLOUT;
+		ev.res = cqe->res;
+		ready.push_back(ev);
+	}
+
+	__atomic_store_n(m_cq_head, head, __ATOMIC_RELEASE);
+
+	return ready.size();
+}
+
+
+reactor *make_reactor(const string &name)
+{
+	if (name == "poll")
+		return new (nothrow) poll_reactor();
+	if (name == "epoll")
+		return new (nothrow) epoll_reactor();
+	if (name == "io_uring")
+		return new (nothrow) uring_reactor();
+	return nullptr;
+}
+
+
+}
+
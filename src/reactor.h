@@ -0,0 +1,284 @@
+/*
+ * This file is part of the hoschi p2p scan engine.
+ *
+ * (C) 2019 by Sebastian Krahmer,
+ *             sebastian [dot] krahmer [at] gmail [dot] com
+ *
+ * hoschi is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * hoschi is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with hoschi. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef hoschi_reactor_h
+#define hoschi_reactor_h
+
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cerrno>
+#include <cstdint>
+#include <poll.h>
+#include <sys/uio.h>
+#include <sys/socket.h>
+
+
+namespace hoschi {
+
+
+// The I/O backend of the scan engine. Events are always passed as
+// POLLIN/POLLOUT/POLLERR/POLLHUP bits, no matter what the backend uses
+// internally. Readiness backends report what the engine may do next,
+// completion backends do the I/O themselves and report what is done.
+class reactor {
+
+protected:
+
+	std::string m_err{""};
+
+	template<class T>
+	T build_error(const std::string &msg, T r)
+	{
+		m_err = "reactor::";
+		m_err += msg;
+
+		if (errno) {
+			m_err += ":";
+			m_err += strerror(errno);
+		}
+		errno = 0;
+		return r;
+	}
+
+public:
+
+	struct event {
+		int fd{-1};
+		int events{0};
+		int res{0};	// completions only: the result, as the syscall would return it or -errno
+	};
+
+	reactor()
+	{
+	}
+
+	virtual ~reactor()
+	{
+	}
+
+	virtual int init(int) = 0;
+
+	virtual int add(int, int) = 0;
+
+	virtual int mod(int, int) = 0;
+
+	virtual int del(int) = 0;
+
+	// fills vector with ready fd's, returns number of fd's or -1 on error
+	virtual int wait(std::vector<event> &, int) = 0;
+
+	// edge triggered backends only report a state change once, so the
+	// engine has to do I/O until EAGAIN before it waits again
+	virtual bool edge_triggered()
+	{
+		return 0;
+	}
+
+	// Completion backends queue connects, reads and writes, which are
+	// reported by wait() as POLLOUT (connect, writev) or POLLIN (read)
+	// along with their result. Buffers, iovecs and addresses must stay
+	// put until then. There is at most one op per direction in flight.
+	virtual bool completions()
+	{
+		return 0;
+	}
+
+	virtual int queue_connect(int, const sockaddr *, socklen_t)
+	{
+		return build_error("queue_connect: Not a completion backend.", -1);
+	}
+
+	virtual int queue_read(int, void *, size_t)
+	{
+		return build_error("queue_read: Not a completion backend.", -1);
+	}
+
+	virtual int queue_writev(int, const iovec *, int)
+	{
+		return build_error("queue_writev: Not a completion backend.", -1);
+	}
+
+	// POLLIN/POLLOUT of the ops in flight for fd
+	virtual int in_flight(int)
+	{
+		return 0;
+	}
+
+	// cancel the ops in flight for fd; they still complete, usually with -ECANCELED
+	virtual int cancel(int)
+	{
+		return 0;
+	}
+
+	virtual const char *name() = 0;
+
+	const char *why()
+	{
+		return m_err.c_str();
+	}
+};
+
+
+class poll_reactor : public reactor {
+
+	pollfd *m_pfds{nullptr};
+
+	int m_first_fd{0}, m_max_fd{-1}, m_nfds{0};
+
+public:
+
+	poll_reactor()
+	{
+	}
+
+	virtual ~poll_reactor()
+	{
+		delete [] m_pfds;
+	}
+
+	int init(int) override;
+
+	int add(int, int) override;
+
+	int mod(int, int) override;
+
+	int del(int) override;
+
+	int wait(std::vector<event> &, int) override;
+
+	const char *name() override
+	{
+		return "poll";
+	}
+};
+
+
+class epoll_reactor : public reactor {
+
+	int m_epfd{-1}, m_nfds{0};
+
+	struct epoll_event *m_events{nullptr};
+
+public:
+
+	epoll_reactor()
+	{
+	}
+
+	virtual ~epoll_reactor();
+
+	int init(int) override;
+
+	int add(int, int) override;
+
+	int mod(int, int) override;
+
+	int del(int) override;
+
+	int wait(std::vector<event> &, int) override;
+
+	bool edge_triggered() override
+	{
+		return 1;
+	}
+
+	const char *name() override
+	{
+		return "epoll";
+	}
+};
+
+
+// io_uring backend. Connects, reads and writes are SQE's of their own and
+// the engine's FSM is driven by their completions, so a handshake needs no
+// syscall for the data path. Everything queued during one engine round is
+// submitted along with the wait in a single io_uring_enter().
+class uring_reactor : public reactor {
+
+	int m_ring_fd{-1}, m_nfds{0};
+
+	void *m_sq_ring{nullptr}, *m_cq_ring{nullptr};
+	size_t m_sq_ring_len{0}, m_cq_ring_len{0}, m_sqes_len{0};
+
+	unsigned *m_sq_head{nullptr}, *m_sq_tail{nullptr}, *m_sq_array{nullptr};
+	unsigned *m_cq_head{nullptr}, *m_cq_tail{nullptr};
+	unsigned m_sq_mask{0}, m_sq_entries{0}, m_cq_mask{0}, m_to_submit{0};
+
+	struct io_uring_sqe *m_sqes{nullptr};
+	struct io_uring_cqe *m_cqes{nullptr};
+
+	// bit (1<<op) for each op in flight, indexed by fd
+	uint8_t *m_ops{nullptr};
+
+	struct io_uring_sqe *get_sqe();
+
+	struct io_uring_sqe *queue_op(int, int);
+
+	int enter(unsigned, unsigned, int timeout = -1);
+
+public:
+
+	uring_reactor()
+	{
+	}
+
+	virtual ~uring_reactor();
+
+	int init(int) override;
+
+	// the engine's interest mask doesn't matter, the ops say what it wants
+	int add(int, int) override;
+
+	int mod(int, int) override;
+
+	int del(int) override;
+
+	int wait(std::vector<event> &, int) override;
+
+	bool completions() override
+	{
+		return 1;
+	}
+
+	int queue_connect(int, const sockaddr *, socklen_t) override;
+
+	int queue_read(int, void *, size_t) override;
+
+	int queue_writev(int, const iovec *, int) override;
+
+	int in_flight(int) override;
+
+	int cancel(int) override;
+
+	const char *name() override
+	{
+		return "io_uring";
+	}
+};
+
+
+reactor *make_reactor(const std::string &);
+
+
+}	// namespace hoschi
+
+#endif
+
@@ -0,0 +1,193 @@
+/*
+ * This file is part of the hoschi p2p scan engine.
+ *
+ * (C) 2019 by Sebastian Krahmer,
+ *             sebastian [dot] krahmer [at] gmail [dot] com
+ *
+ * hoschi is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * hoschi is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with hoschi. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <vector>
+#include <new>
+#include <cstdint>
+#include <time.h>
+#include "timer.h"
+
+
+using namespace std;
+
+
+namespace hoschi {
+
+
+int timer_wheel::init(int max)
+{
+	if ((m_timers = new (nothrow) timer[max]) == nullptr)
+		return -1;
+
+	for (int l = 0; l < levels; ++l) {
+		for (int s = 0; s < slots; ++s)
+			m_heads[l][s] = -1;
+	}
+
+	m_max = max;
+	m_tick = now();
+	return 0;
+}
+
+
+void timer_wheel::link(int id)
+{
+	timer &t = m_timers[id];
+
+	uint64_t delta = t.expires - m_tick;
+
+	// too far in future for the whole wheel? Fire at the end of it.
+	if (delta >= (1ULL<<(slot_bits*levels))) {
+		delta = (1ULL<<(slot_bits*levels)) - 1;
+		t.expires = m_tick + delta;
+	}
+
+	int l = 0;
+	for (; l < levels - 1; ++l) {
+		if (delta < (1ULL<<(slot_bits*(l + 1))))
+			break;
+	}
+
+	t.level = l;
+	t.slot = (t.expires>>(slot_bits*l)) & slot_mask;
+	t.prev = -1;
+	t.next = m_heads[l][t.slot];
+	if (t.next != -1)
+		m_timers[t.next].prev = id;
+	m_heads[l][t.slot] = id;
+}
+
+
+void timer_wheel::unlink(int id)
+{
+	timer &t = m_timers[id];
+
+	if (t.prev != -1)
+		m_timers[t.prev].next = t.next;
+	else
+		m_heads[t.level][t.slot] = t.next;
+	if (t.next != -1)
+		m_timers[t.next].prev = t.prev;
+
+	t.prev = t.next = -1;
+	t.level = -1;
+}
+
+
+// move timers of the current slot of level l down to where they belong now
+void timer_wheel::cascade(int l)
+{
+	int idx = (m_tick>>(slot_bits*l)) & slot_mask;
+	int id = m_heads[l][idx];
+
+	m_heads[l][idx] = -1;
+
+	while (id != -1) {
+		int next = m_timers[id].next;
+		link(id);
+		id = next;
+	}
+}
+
+
+void timer_wheel::arm(int id, uint32_t ms)
+{
+	if (id < 0 || id >= m_max)
+		return;
+
+	if (m_timers[id].level >= 0)
+		unlink(id);
+	else
+		++m_armed;
+
+	m_timers[id].expires = now() + ms;
+	if (m_timers[id].expires <= m_tick)
+		m_timers[id].expires = m_tick + 1;
+
+	link(id);
+}
+
+
+void timer_wheel::disarm(int id)
+{
+	if (id < 0 || id >= m_max || m_timers[id].level < 0)
+		return;
+
+	unlink(id);
+	--m_armed;
+}
+
+
+size_t timer_wheel::expire(uint64_t ms, vector<int> &expired)
+{
+	expired.clear();
+
+	// nothing to walk through
+	if (m_armed == 0 && ms > m_tick)
+		m_tick = ms;
+
+	while (m_tick < ms) {
+		++m_tick;
+
+		if ((m_tick & slot_mask) == 0) {
+			for (int l = 1; l < levels; ++l) {
+				cascade(l);
+				if (((m_tick>>(slot_bits*l)) & slot_mask) != 0)
+					break;
+			}
+		}
+
+		int idx = m_tick & slot_mask;
+		while (m_heads[0][idx] != -1) {
+			int id = m_heads[0][idx];
+			unlink(id);
+			--m_armed;
+			expired.push_back(id);
+		}
+	}
+
+	return expired.size();
+}
+
+
+int timer_wheel::next_timeout(int max)
+{
+	if (m_armed == 0)
+		return max;
+
+	uint64_t behind = now() - m_tick;
+	int i = 1;
+
+	for (; i < slots - int(m_tick & slot_mask); ++i) {
+		if (m_heads[0][(m_tick + i) & slot_mask] != -1)
+			break;
+	}
+
+	// otherwise wake up when level 0 wraps, cascading may bring timers down
+	if (uint64_t(i) <= behind)
+		return 0;
+	if (i - behind < uint64_t(max))
+		return i - behind;
+	return max;
+}
+
+
+}
+
@@ -0,0 +1,117 @@
+/*
+ * This file is part of the hoschi p2p scan engine.
+ *
+ * (C) 2019 by Sebastian Krahmer,
+ *             sebastian [dot] krahmer [at] gmail [dot] com
+ *
+ * hoschi is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * hoschi is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with hoschi. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef hoschi_timer_h
+#define hoschi_timer_h
+
+#include <vector>
+#include <cstdint>
+#include <time.h>
+
+
+namespace hoschi {
+
+
+// Hierarchical timer wheel with 1ms ticks on CLOCK_MONOTONIC. There is
+// at most one timer per id (the fd of a node), kept in intrusive lists, so
+// arming and disarming is O(1) and without allocations. Timers of the upper
+// levels are cascaded down when the level below wraps around.
+class timer_wheel {
+
+	enum {
+		levels		= 4,
+		slot_bits	= 8,
+		slots		= 1<<slot_bits,
+		slot_mask	= slots - 1
+	};
+
+	struct timer {
+		uint64_t expires{0};
+		int prev{-1}, next{-1};
+		int16_t level{-1};
+		uint16_t slot{0};
+	};
+
+	timer *m_timers{nullptr};
+
+	int m_heads[levels][slots];
+
+	int m_max{0};
+
+	size_t m_armed{0};
+
+	// all ticks up to and including this one have been processed
+	uint64_t m_tick{0};
+
+	void link(int);
+
+	void unlink(int);
+
+	void cascade(int);
+
+public:
+
+	timer_wheel()
+	{
+	}
+
+	virtual ~timer_wheel()
+	{
+		delete [] m_timers;
+	}
+
+	static uint64_t now()
+	{
+		timespec ts;
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		return uint64_t(ts.tv_sec)*1000 + ts.tv_nsec/1000000;
+	}
+
+	static uint64_t now_us()
+	{
+		timespec ts;
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		return uint64_t(ts.tv_sec)*1000000 + ts.tv_nsec/1000;
+	}
+
+	int init(int);
+
+	// (re-)arm timer of id to fire in ms milliseconds
+	void arm(int, uint32_t);
+
+	void disarm(int);
+
+	// collect ids whose timers expired until now, and disarm them
+	size_t expire(uint64_t, std::vector<int> &);
+
+	// milliseconds until the next expiry, but not more than the given max
+	int next_timeout(int);
+
+	size_t armed()
+	{
+		return m_armed;
+	}
+};
+
+
+}
+
+#endif
+
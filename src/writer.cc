@@ -0,0 +1,191 @@
+/*
+ * This file is part of the hoschi p2p scan engine.
+ *
+ * (C) 2019 by Sebastian Krahmer,
+ *             sebastian [dot] krahmer [at] gmail [dot] com
+ *
+ * hoschi is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * hoschi is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with hoschi. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <new>
+#include <string>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <cerrno>
+#include <cstring>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "writer.h"
+#include "global.h"
+#include "misc.h"
+
+
+using namespace std;
+
+
+namespace hoschi {
+
+
+result_writer::~result_writer()
+{
+	stop();
+
+	record *r = nullptr;
+	while ((r = dequeue()) != nullptr)
+		delete r;
+}
+
+
+int result_writer::init(const string &path, int fsync_policy)
+{
+	if ((m_fd = open(path.c_str(), O_WRONLY|O_CREAT|O_APPEND|O_CLOEXEC, 0644)) < 0)
+		return -1;
+
+	m_fsync = fsync_policy;
+	m_last_sync = time(nullptr);
+	m_batch.reserve(numbers::max_write_batch);
+
+	m_thread = thread(&result_writer::run, this);
+	return 0;
+}
+
+
+void result_writer::enqueue(record *r)
+{
+	r->next.store(nullptr, memory_order_relaxed);
+	record *prev = m_head.exchange(r, memory_order_acq_rel);
+	prev->next.store(r, memory_order_release);
+}
+
+
+// only called by the writer thread
+result_writer::record *result_writer::dequeue()
+{
+	record *tail = m_tail, *next = tail->next.load(memory_order_acquire);
+
+	if (tail == &m_stub) {
+		if (!next)
+			return nullptr;
+		m_tail = tail = next;
+		next = next->next.load(memory_order_acquire);
+	}
+
+	if (next) {
+		m_tail = next;
+		return tail;
+	}
+
+	// a producer is just in the middle of linking in a new record
+	if (tail != m_head.load(memory_order_acquire))
+		return nullptr;
+
+	enqueue(&m_stub);
+
+	if ((next = tail->next.load(memory_order_acquire)) != nullptr) {
+		m_tail = next;
+		return tail;
+	}
+
+	return nullptr;
+}
+
+
+void result_writer::push(string &&line)
+{
+	record *r = new (nothrow) record;
+	if (!r)
+		return;
+	r->line = move(line);
+	enqueue(r);
+}
+
+
+bool result_writer::flush()
+{
+	bool wrote = 0;
+	record *r = nullptr;
+
+	for (;;) {
+		m_batch.clear();
+
+		uint64_t n = 0;
+		while (m_batch.size() < numbers::max_write_batch && (r = dequeue()) != nullptr) {
+			m_batch += r->line;
+			delete r;
+			++n;
+		}
+
+		if (m_batch.empty())
+			break;
+
+		for (size_t off = 0; off < m_batch.size();) {
+			ssize_t w = write(m_fd, m_batch.c_str() + off, m_batch.size() - off);
+			if (w < 0) {
+				if (errno == EINTR)
+					continue;
+				LOG_LIMITED(logtag::writer, loglevel::error, "Lost results, write failed: " + string(strerror(errno)));
+				break;
+			}
+			off += w;
+		}
+
+		m_records += n;
+		m_bytes += m_batch.size();
+		++m_batches;
+		wrote = 1;
+	}
+
+	if (!wrote || m_fsync < 0)
+		return wrote;
+
+	time_t now = time(nullptr);
+	if (now - m_last_sync >= m_fsync) {
+		fdatasync(m_fd);
+		m_last_sync = now;
+	}
+
+	return wrote;
+}
+
+
+void result_writer::run()
+{
+	while (!m_stop.load(memory_order_acquire)) {
+		if (!flush())
+			this_thread::sleep_for(chrono::milliseconds(timeouts::writer_idle));
+	}
+}
+
+
+void result_writer::stop()
+{
+	if (!m_thread.joinable())
+		return;
+
+	m_stop.store(1, memory_order_release);
+	m_thread.join();
+
+	// the shards are done, so this gets everything
+	flush();
+	if (m_fsync >= 0)
+		fdatasync(m_fd);
+	close(m_fd);
+	m_fd = -1;
+}
+
+
+}
+
@@ -0,0 +1,109 @@
+/*
+ * This file is part of the hoschi p2p scan engine.
+ *
+ * (C) 2019 by Sebastian Krahmer,
+ *             sebastian [dot] krahmer [at] gmail [dot] com
+ *
+ * hoschi is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * hoschi is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with hoschi. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef hoschi_writer_h
+#define hoschi_writer_h
+
+#include <string>
+#include <atomic>
+#include <thread>
+#include <cstdint>
+#include <cstddef>
+
+
+namespace hoschi {
+
+
+// Writes the dump file from a thread of its own, so the scan engines never
+// block on disk. Shards push finished lines into a lock free MPSC queue
+// (Vyukov's intrusive one), and the writer drains it periodically and writes
+// everything it found with one write() into the file that it keeps open.
+class result_writer {
+
+	struct record {
+		std::atomic<record *> next{nullptr};
+		std::string line{""};
+	};
+
+	std::atomic<record *> m_head{&m_stub};
+	record *m_tail{&m_stub}, m_stub;
+
+	int m_fd{-1};
+
+	// -1 never fsync, 0 after every batch, n every n seconds
+	int m_fsync{-1};
+
+	time_t m_last_sync{0};
+
+	std::atomic<bool> m_stop{0};
+
+	std::thread m_thread;
+
+	std::string m_batch{""};
+
+	std::atomic<uint64_t> m_records{0}, m_bytes{0}, m_batches{0};
+
+	void enqueue(record *);
+
+	record *dequeue();
+
+	// write what is queued; true if anything was written
+	bool flush();
+
+	void run();
+
+public:
+
+	result_writer()
+	{
+	}
+
+	virtual ~result_writer();
+
+	// open file and start the writer thread
+	int init(const std::string &, int);
+
+	// hand a line over to the writer; never blocks
+	void push(std::string &&);
+
+	// write everything still queued and stop the writer thread
+	void stop();
+
+	uint64_t records()
+	{
+		return m_records;
+	}
+
+	uint64_t bytes()
+	{
+		return m_bytes;
+	}
+
+	uint64_t batches()
+	{
+		return m_batches;
+	}
+};
+
+
+}
+
+#endif
+